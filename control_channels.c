@@ -33,21 +33,216 @@ along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
  *
  * Changelog: (date,who,description)
  */
+
+#ifdef __linux__
+// pthread_attr_setaffinity_np, CPU_SET
+#define _GNU_SOURCE
+#endif
+
 #include "RMCIOS-functions.h"
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include "pid.h"
+#include "monotonic_time.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#endif
 
 /////////////////////////////////////////////////////////////
 //! Ramp channel
 //////////////////////////////////////////////////////////////
+enum ramp_type
+{
+   ramp_list,
+   ramp_lin,
+   ramp_log
+};
+
 struct ramp_data
 {
    int size;
-   float *values;
+   float *values;       // type=list storage
    int index;
+
+   // lin and log ramps are calculated on demand
+   enum ramp_type type;
+   double start;        // log(start) for type=log
+   double end;          // log(end) for type=log
+
+   // Vector output
+   int id;
+   float *batch;
+   int batch_size;
 };
 
+// Value of the ramp at index
+float ramp_value (struct ramp_data *this, int index)
+{
+   double value;
+   switch (this->type)
+   {
+   case ramp_list:
+      return this->values[index];
+   default:
+      if (this->size > 1)
+         value = this->start 
+                 + (this->end - this->start) * index / (this->size - 1);
+      else
+         value = this->start;
+      if (this->type == ramp_log)
+         value = exp (value);
+      return value;
+   }
+}
+
+// Set start and end of lin/log ramp
+void ramp_set_range (struct ramp_data *this, double start, double end)
+{
+   if (this->type == ramp_log)
+   {
+      this->start = log (start);
+      this->end = log (end);
+   }
+   else
+   {
+      this->start = start;
+      this->end = end;
+   }
+}
+
+void ramp_range_subchan_func (struct ramp_data *this,
+                              const struct context_rmcios *context, int id,
+                              enum function_rmcios function,
+                              enum type_rmcios paramtype,
+                              struct combo_rmcios *returnv,
+                              int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL || this->type == ramp_list)
+         break;
+      return_float (context, returnv, ramp_value (this, 0));
+      return_float (context, returnv, ramp_value (this, this->size - 1));
+      return_int (context, returnv, this->size);
+      break;
+
+   case write_rmcios:
+      // Change lin/log ramp without restarting it
+      if (this == NULL || this->type == ramp_list)
+         break;
+      if (num_params < 2)
+         break;
+      ramp_set_range (this, param_to_float (context, paramtype, param, 0),
+                      param_to_float (context, paramtype, param, 1));
+      if (num_params < 3)
+         break;
+      {
+         int size = param_to_integer (context, paramtype, param, 2);
+         int running = this->index < this->size;
+         if (size < 1)
+            break;
+         this->size = size;
+         if (!running || this->index > this->size)
+            this->index = this->size;
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+// Fill values of the ramp from first to buffer. 
+// Returns pointer to the values.
+const float *ramp_values (struct ramp_data *this, int first, int count)
+{
+   int i;
+   if (this->type == ramp_list)
+      return this->values + first;
+   if (count > this->batch_size)
+   {
+      float *batch = realloc (this->batch, count * sizeof (float));
+      if (batch == NULL)
+         return NULL;
+      this->batch = batch;
+      this->batch_size = count;
+   }
+   for (i = 0; i < count; i++)
+      this->batch[i] = ramp_value (this, first + i);
+   return this->batch;
+}
+
+void ramp_batch_subchan_func (struct ramp_data *this,
+                              const struct context_rmcios *context, int id,
+                              enum function_rmcios function,
+                              enum type_rmcios paramtype,
+                              struct combo_rmcios *returnv,
+                              int num_params, const union param_rmcios param)
+{
+   int first;
+   int count;
+   int i;
+   const float *values;
+
+   switch (function)
+   {
+   case read_rmcios:
+      // Return whole ramp or window of it
+      if (this == NULL)
+         break;
+      first = 0;
+      if (num_params > 0)
+         first = param_to_integer (context, paramtype, param, 0);
+      if (first < 0)
+         first = 0;
+      count = this->size - first;
+      if (num_params > 1)
+         count = param_to_integer (context, paramtype, param, 1);
+      if (count > this->size - first)
+         count = this->size - first;
+      for (i = 0; i < count; i++)
+         return_float (context, returnv, ramp_value (this, first + i));
+      break;
+
+   case write_rmcios:
+      // Run K steps of the ramp as single vector write
+      if (this == NULL)
+         break;
+      if (this->index >= this->size)
+         break;
+      count = this->size - this->index;
+      if (num_params > 0)
+         count = param_to_integer (context, paramtype, param, 0);
+      if (count > this->size - this->index)
+         count = this->size - this->index;
+      if (count < 1)
+         break;
+      values = ramp_values (this, this->index, count);
+      if (values == NULL)
+      {
+         info (context, context->errors,
+               "ramp: Could not allocate batch buffer!\r\n");
+         break;
+      }
+      this->index += count;
+      write_fv (context, linked_channels (context, this->id), count, values);
+      // Empty write signaled after a scan ramp.
+      if (this->index == this->size)
+         write_fv (context, linked_channels (context, this->id), 0, NULL);
+      break;
+
+   default:
+      break;
+   }
+}
+
 void ramp_class_func (struct ramp_data *this,
                       const struct context_rmcios *context, int id,
                       enum function_rmcios function,
@@ -80,6 +275,15 @@ void ramp_class_func (struct ramp_data *this,
                      "  -restart ramp\r\n"
                      "write newname\r\n"
                      "  run one step of the ramp\r\n"
+                     "write newname_range start end | size\r\n"
+                     "  -change lin/log ramp without restarting it\r\n"
+                     "read newname_range\r\n"
+                     "  -read start end and size of lin/log ramp\r\n"
+                     "write newname_batch | steps\r\n"
+                     "  -run next steps (default: rest of the ramp) and"
+                     " send them to linked channels as one vector\r\n"
+                     "read newname_batch | first | count\r\n"
+                     "  -read whole ramp or window of it\r\n"
                      "link newname channel\r\n"
                      "  link ramp output to a channel\r\n"
                      "link newname channel\r\n");
@@ -100,10 +304,19 @@ void ramp_class_func (struct ramp_data *this,
       this->size = 0;
       this->values = NULL;
       this->index = 0;
+      this->type = ramp_list;
+      this->start = 0;
+      this->end = 0;
+      this->batch = NULL;
+      this->batch_size = 0;
 
       // create the channel
-      create_channel_param (context, paramtype, param, 0, 
-                            (class_rmcios) ramp_class_func, this); 
+      this->id = create_channel_param (context, paramtype, param, 0, 
+                                       (class_rmcios) ramp_class_func, this); 
+      create_subchannel_str (context, this->id, "_range",
+                             (class_rmcios) ramp_range_subchan_func, this);
+      create_subchannel_str (context, this->id, "_batch",
+                             (class_rmcios) ramp_batch_subchan_func, this);
       break;
 
    case setup_rmcios:
@@ -119,63 +332,58 @@ void ramp_class_func (struct ramp_data *this,
 
          param_to_string (context, paramtype, param, 0, sizeof (type), type);
 
-         if (this->values != NULL)
-         {
-            free (this->values);
-            this->values = NULL;
-         }
-
          if (strcmp (type, "single") == 0)      
-          // Fill the single value to array
+         // Single value ramp
          {
+            if (this->values != NULL)
+            {
+               free (this->values);
+               this->values = NULL;
+            }
+            this->type = ramp_lin;
             this->size = 1;
-            this->values = malloc (sizeof (float));
-            this->values[0] = param_to_float (context, paramtype, param, 1);
+            this->start = param_to_float (context, paramtype, param, 1);
+            this->end = this->start;
             // Ramp is not initially running
             this->index = this->size;   
          }
 
-         if (strcmp (type, "lin") == 0) 
-         // Calculate linear ramp to array
+         if (strcmp (type, "lin") == 0 || strcmp (type, "log") == 0) 
+         // Linear or log ramp. Values are calculated on each step.
          {
+            int size;
             if (num_params < 4)
                break;
-            int i;
-            float start = param_to_float (context, paramtype, param, 1);
-            float end = param_to_float (context, paramtype, param, 2);
-            this->size = param_to_integer (context, paramtype, param, 3);
-            this->values = malloc (this->size * sizeof (float));
-            for (i = 0; i < this->size; i++)
+            size = param_to_integer (context, paramtype, param, 3);
+            if (size < 1)
+               break;
+            if (this->values != NULL)
             {
-               this->values[i] = (end - start) / (this->size - 1) * i + start;
+               free (this->values);
+               this->values = NULL;
             }
+            this->type = (type[1] == 'o') ? ramp_log : ramp_lin;
+            this->size = size;
+            ramp_set_range (this, 
+                            param_to_float (context, paramtype, param, 1),
+                            param_to_float (context, paramtype, param, 2));
             // Ramp is not initially running
             this->index = this->size;   
          }
 
-         if (strcmp (type, "log") == 0) 
-         // Calculate log ramp to array
-         {
-            if (num_params < 4)
-               break;
-            int i;
-            float start = log (param_to_float (context, paramtype, param, 1));
-            float end = log (param_to_float (context, paramtype, param, 2));
-            this->size = param_to_integer (context, paramtype, param, 3);
-            this->values = malloc (this->size * sizeof (float));
-            for (i = 0; i < this->size; i++)
-            {
-               this->values[i] =
-                  exp ((end - start) / (this->size - 1) * i + start);
-            }
-            this->index = this->size;   // Ramp is not initially running
-         }
-
          if (strcmp (type, "list") == 0)        // Fill given values to array
          {
             int i;
+            if (this->values != NULL)
+               free (this->values);
+            this->type = ramp_list;
             this->size = num_params - 1;
             this->values = malloc (this->size * sizeof (float));
+            if (this->values == NULL)
+            {
+               this->size = 0;
+               break;
+            }
             for (i = 0; i < this->size; i++)
             {
                this->values[i] =
@@ -193,7 +401,7 @@ void ramp_class_func (struct ramp_data *this,
       {
          // Write next step of the ramp
          write_f (context, linked_channels (context, id),
-                  this->values[this->index++]);
+                  ramp_value (this, this->index++));
          // Empty write signaled after a scan ramp.
          if (this->index == this->size)
             write_fv (context, linked_channels (context, id), 0, NULL);
@@ -301,9 +509,349 @@ void timerpwm_class_func (struct timerpwm_data *this,
    }
 }
 
+/////////////////////////////////////////////////////////////////////////
+//! Channel for multiple pwm outputs driven by single external timer  //
+/////////////////////////////////////////////////////////////////////////
+struct pwm_edge
+{
+   float time;          // s from period start
+   int output;
+   char state;
+};
+
+struct pwm_data
+{
+   int self;
+   int timer_channel;
+   float period;        // s
+   int stagger;         // spread output on-times over the period
+
+   int num_outputs;
+   int *outputs;
+   float *duty;         // duty cycles of the running period
+   float *pending;      // duty cycles for the next period
+   int pending_update;
+   char *state;
+
+   // Sorted edges of the running period
+   struct pwm_edge *edges;
+   int num_edges;
+   int next_edge;
+   float time;          // s, time of the latest timer event in the period
+};
+
+int pwm_edge_compare (const void *a, const void *b)
+{
+   float ta = ((const struct pwm_edge *) a)->time;
+   float tb = ((const struct pwm_edge *) b)->time;
+   return (ta > tb) - (ta < tb);
+}
+
+void pwm_set_output (struct pwm_data *this, const struct context_rmcios *context,
+                     int output, char state)
+{
+   if (this->state[output] == state)
+      return;
+   this->state[output] = state;
+   write_i (context, this->outputs[output], state);
+}
+
+// Start new period. Takes new duty cycles into use.
+void pwm_start_period (struct pwm_data *this,
+                       const struct context_rmcios *context)
+{
+   int i;
+
+   if (this->pending_update)
+   {
+      // Rebuild sorted edge list only when duty cycles change
+      this->pending_update = 0;
+      this->num_edges = 0;
+      for (i = 0; i < this->num_outputs; i++)
+      {
+         float offset = 0;
+         float on, off;
+
+         this->duty[i] = this->pending[i];
+         if (this->duty[i] <= 0 || this->duty[i] >= 1)
+            continue;
+         if (this->stagger)
+            offset = this->period * i / this->num_outputs;
+         on = offset;
+         off = offset + this->period * this->duty[i];
+         if (off >= this->period)
+            off -= this->period;
+         // Edges at period start are handled as initial state
+         if (on > 0)
+         {
+            this->edges[this->num_edges].time = on;
+            this->edges[this->num_edges].output = i;
+            this->edges[this->num_edges++].state = 1;
+         }
+         if (off > 0)
+         {
+            this->edges[this->num_edges].time = off;
+            this->edges[this->num_edges].output = i;
+            this->edges[this->num_edges++].state = 0;
+         }
+      }
+      qsort (this->edges, this->num_edges, sizeof (struct pwm_edge),
+             pwm_edge_compare);
+   }
+
+   // Output states at the start of the period
+   for (i = 0; i < this->num_outputs; i++)
+   {
+      char state;
+      float on, off;
+      if (this->duty[i] <= 0)
+         state = 0;
+      else if (this->duty[i] >= 1)
+         state = 1;
+      else
+      {
+         on = this->stagger ? this->period * i / this->num_outputs : 0;
+         off = on + this->period * this->duty[i];
+         if (off >= this->period)
+            // On-time wraps over period boundary
+            state = (off - this->period) > 0;
+         else
+            state = (on == 0);
+      }
+      pwm_set_output (this, context, i, state);
+   }
+
+   this->next_edge = 0;
+   this->time = 0;
+}
+
+// Re-arm the timer for the next edge or period boundary
+void pwm_arm_timer (struct pwm_data *this, const struct context_rmcios *context)
+{
+   if (this->next_edge < this->num_edges)
+      write_f (context, this->timer_channel,
+               this->edges[this->next_edge].time - this->time);
+   else
+      write_f (context, this->timer_channel, this->period - this->time);
+}
+
+void pwm_duty_subchan_func (struct pwm_data *this,
+                            const struct context_rmcios *context, int id,
+                            enum function_rmcios function,
+                            enum type_rmcios paramtype,
+                            struct combo_rmcios *returnv,
+                            int num_params, const union param_rmcios param)
+{
+   int output;
+   if (this == NULL || num_params < 1)
+      return;
+   output = param_to_int (context, paramtype, param, 0);
+   if (output < 0 || output >= this->num_outputs)
+      return;
+
+   switch (function)
+   {
+   case read_rmcios:
+      return_float (context, returnv, this->duty[output]);
+      break;
+   case write_rmcios:
+      if (num_params < 2)
+         break;
+      this->pending[output] = param_to_float (context, paramtype, param, 1);
+      this->pending_update = 1;
+      break;
+   default:
+      break;
+   }
+}
+
+void pwm_class_func (struct pwm_data *this,
+                     const struct context_rmcios *context, int id,
+                     enum function_rmcios function,
+                     enum type_rmcios paramtype,
+                     struct combo_rmcios *returnv,
+                     int num_params, const union param_rmcios param)
+{
+   int i;
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "help for pwm channel\r\n"
+                     " Multiple pwm outputs driven by single timer.\r\n"
+                     " create pwm newname\r\n"
+                     " setup newname frequency timer_channel | stagger(0/1)"
+                     " | output_channels...\r\n"
+                     "  -stagger=1 spreads on-times of the outputs"
+                     " evenly over the period\r\n"
+                     " write newname # timer event (called from the timer)\r\n"
+                     " write newname duty_cycle0 duty_cycle1... #(0..1)\r\n"
+                     " write newname_duty output duty_cycle #(0..1)\r\n"
+                     "  -New duty cycles are used from next period start\r\n"
+                     " read newname_duty output\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      // allocate new data
+      this = (struct pwm_data *) 
+              allocate_storage (context, sizeof (struct pwm_data), 0);     
+      if (this == NULL)
+         break;
+
+      // Default values:
+      this->timer_channel = 0;
+      this->period = 1;
+      this->stagger = 0;
+      this->num_outputs = 0;
+      this->outputs = NULL;
+      this->duty = NULL;
+      this->pending = NULL;
+      this->pending_update = 0;
+      this->state = NULL;
+      this->edges = NULL;
+      this->num_edges = 0;
+      this->next_edge = 0;
+      this->time = 0;
+
+      // create channel
+      this->self = create_channel_param (context, paramtype, param, 0, 
+                                         (class_rmcios) pwm_class_func, 
+                                         this);       
+      create_subchannel_str (context, this->self, "_duty",
+                             (class_rmcios) pwm_duty_subchan_func, this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         float frequency = param_to_float (context, paramtype, param, 0);
+         if (!(frequency > 0))
+         {
+            info (context, context->errors,
+                  "pwm: Frequency must be positive!\r\n");
+            break;
+         }
+         this->period = 1.0 / frequency;
+      }
+      this->pending_update = 1;
+      if (num_params < 2)
+         break;
+      this->timer_channel = param_to_int (context, paramtype, param, 1);
+      link_channel (context, this->timer_channel, this->self);
+      if (num_params > 2)
+         this->stagger = param_to_int (context, paramtype, param, 2);
+      if (num_params > 3)
+      {
+         int n = num_params - 3;
+         free (this->outputs);
+         free (this->duty);
+         free (this->pending);
+         free (this->state);
+         free (this->edges);
+         this->outputs = malloc (n * sizeof (int));
+         this->duty = malloc (n * sizeof (float));
+         this->pending = malloc (n * sizeof (float));
+         this->state = malloc (n);
+         this->edges = malloc (2 * n * sizeof (struct pwm_edge));
+         this->num_outputs = 0;
+         this->num_edges = 0;
+         if (this->outputs == NULL || this->duty == NULL 
+             || this->pending == NULL || this->state == NULL 
+             || this->edges == NULL)
+         {
+            info (context, context->errors,
+                  "pwm: Could not allocate outputs!\r\n");
+            break;
+         }
+         for (i = 0; i < n; i++)
+         {
+            this->outputs[i] = param_to_int (context, paramtype, param, i + 3);
+            this->duty[i] = 0;
+            this->pending[i] = 0;
+            // Force initial write
+            this->state[i] = -1;
+         }
+         this->num_outputs = n;
+      }
+
+      // Restart
+      if (this->timer_channel != 0)
+      {
+         pwm_start_period (this, context);
+         pwm_arm_timer (this, context);
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)      
+      // Timer event
+      {
+         if (this->timer_channel == 0)
+            break;
+         if (this->next_edge >= this->num_edges)
+            pwm_start_period (this, context);
+         else
+         {
+            // Apply all edges that occur at this time
+            this->time = this->edges[this->next_edge].time;
+            while (this->next_edge < this->num_edges
+                   && this->edges[this->next_edge].time <= this->time)
+            {
+               struct pwm_edge *edge = this->edges + this->next_edge++;
+               pwm_set_output (this, context, edge->output, edge->state);
+            }
+         }
+         pwm_arm_timer (this, context);
+      }
+      else
+      {
+         // New duty cycles for next period
+         for (i = 0; i < num_params && i < this->num_outputs; i++)
+            this->pending[i] = param_to_float (context, paramtype, param, i);
+         this->pending_update = 1;
+      }
+      break;
+   }
+}
+
 /////////////////////////////////////////////////
 // PID Controller Channel
 /////////////////////////////////////////////////
+// Time elapsed since previous update. 
+// Timestamp from write parameter is preferred, then clock channel.
+// Without either the internal monotonic clock is used. 
+// Returns 0 on the first update.
+float pid_elapsed_time (const struct context_rmcios *context,
+                        int clock_channel, double *last_time,
+                        int has_timestamp, double timestamp)
+{
+   double now;
+   float dt;
+   if (has_timestamp)
+      now = timestamp;
+   else if (clock_channel != 0)
+   {
+      // reset clock for elapsed time (empty write)
+      return write_fv (context, clock_channel, 0, NULL);
+   }
+   else
+      now = monotonic_time ();
+
+   if (isnan (*last_time))
+      dt = 0;
+   else
+      dt = now - *last_time;
+   *last_time = now;
+   return dt;
+}
+
 void pid_setp_subchan_func (struct pid_type *this,
                             const struct context_rmcios *context, int id,
                             enum function_rmcios function,
@@ -346,7 +894,10 @@ void pid_class_func (struct pid_type *this,
                      " create pid newname \r\n"
                      " setup newname setpoint clk_channel Kp Ki Kd"
                      " inp_min input_max output_min output_max |\r\n"
-                     " write newname inputvalue\r\n"
+                     "  -clk_channel 0 : use internal monotonic clock\r\n"
+                     " write newname inputvalue | timestamp\r\n"
+                     "  -timestamp: time of the input in seconds"
+                     " with sub-ms precision. Used instead of clock\r\n"
                      " read newname # read latest contol value\r\n"
                      " write newname_setpoint value # setpoint new setpoint\r\n"
                      " link newname channel # link control to channel\r\n");
@@ -371,6 +922,7 @@ void pid_class_func (struct pid_type *this,
          this->output_min = 0;
          this->output_max = 1;
          this->clock_channel = 0;
+         this->last_time = NAN;
 
          this->previous_error = 0;
          this->integral = 0;
@@ -414,8 +966,14 @@ void pid_class_func (struct pid_type *this,
       if (num_params < 1)
          break;
 
-      // reset clock for elapsed time (empty write)
-      time = write_fv (context, this->clock_channel, 0, NULL);  
+      if (num_params > 1)
+         time = pid_elapsed_time (context, this->clock_channel, 
+                                  &this->last_time, 1,
+                                  param_to_timestamp (context, paramtype,
+                                                      param, 1));
+      else
+         time = pid_elapsed_time (context, this->clock_channel, 
+                                  &this->last_time, 0, 0);
       control_value =
          pid_control (this,
                       param_to_float (context, paramtype, param, 0), time);
@@ -432,17 +990,1298 @@ void pid_class_func (struct pid_type *this,
    }
 }
 
-/////////////////////////////////////////////////////////
-//! wait time reserved bus
-/////////////////////////////////////////////////////////
-struct delayed_bus_data
+/////////////////////////////////////////////////
+// Batch PID Controller Channel
+/////////////////////////////////////////////////
+void pid_batch_loop_subchan_func (struct pid_batch_type *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
 {
-   float reserve_time;
-   int wait_channel;
-   int share_register;
-};
+   int i;
+   if (this == NULL || num_params < 1)
+      return;
+   i = param_to_int (context, paramtype, param, 0);
+   if (i < 0 || i >= this->size)
+      return;
 
-// timeslot sharing of linked channels
+   switch (function)
+   {
+   case read_rmcios:
+      return_float (context, returnv, this->output[i]);
+      break;
+   case write_rmcios:
+      if (num_params < 2)
+         break;
+      this->setpoint[i] = param_to_float (context, paramtype, param, 1);
+      if (num_params < 9)
+         break;
+      this->Kp[i] = param_to_float (context, paramtype, param, 2);
+      this->Ki[i] = param_to_float (context, paramtype, param, 3);
+      this->Kd[i] = param_to_float (context, paramtype, param, 4);
+      this->input_min[i] = param_to_float (context, paramtype, param, 5);
+      this->input_max[i] = param_to_float (context, paramtype, param, 6);
+      this->output_min[i] = param_to_float (context, paramtype, param, 7);
+      this->output_max[i] = param_to_float (context, paramtype, param, 8);
+      break;
+   default:
+      break;
+   }
+}
+
+void pid_batch_class_func (struct pid_batch_type *this,
+                           const struct context_rmcios *context, int id,
+                           enum function_rmcios function,
+                           enum type_rmcios paramtype,
+                           struct combo_rmcios *returnv,
+                           int num_params, const union param_rmcios param)
+{
+   int i;
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "batch pid controller channel help\r\n"
+                     "Updates many pid loops in one pass.\r\n"
+                     " create pidbatch newname \r\n"
+                     " setup newname loops clk_channel |"
+                     " output_channels...\r\n"
+                     "  -same number of loops keeps gains and state\r\n"
+                     "  -clk_channel 0 : use internal monotonic clock\r\n"
+                     "  -output_channels: optional output for each loop\r\n"
+                     " write newname_loop index setpoint | Kp Ki Kd"
+                     " inp_min input_max output_min output_max\r\n"
+                     " read newname_loop index # read control value\r\n"
+                     " write newname input0 input1... | timestamp\r\n"
+                     "  -timestamp: time of the inputs in seconds"
+                     " with sub-ms precision. Used instead of clock\r\n"
+                     "  -update all loops. Controls are sent to linked"
+                     " channels as one vector\r\n"
+                     " read newname # read latest contol values\r\n"
+                     " link newname channel # link controls to channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      // allocate new data
+      this = (struct pid_batch_type *) 
+             allocate_storage (context, sizeof (struct pid_batch_type), 0);
+      if (this == NULL)
+         break;
+      this->size = 0;
+      this->setpoint = NULL;
+      this->linked_channel = NULL;
+      this->clock_channel = 0;
+      this->last_time = NAN;
+
+      // create channel
+      id = create_channel_param (context, paramtype, param, 0, 
+                                 (class_rmcios) pid_batch_class_func, this); 
+      create_subchannel_str (context, id, "_loop", 
+                             (class_rmcios) pid_batch_loop_subchan_func, 
+                             this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      {
+         int size = param_to_int (context, paramtype, param, 0);
+         float *data;
+         int *linked;
+         if (size < 1)
+            break;
+         // Same size keeps gains and controller state for bumpless retune
+         if (size != this->size)
+         {
+            // Single block for all loop arrays
+            data = malloc (11 * size * sizeof (float));
+            linked = calloc (size, sizeof (int));
+            if (data == NULL || linked == NULL)
+            {
+               free (data);
+               free (linked);
+               info (context, context->errors,
+                     "pidbatch: Could not allocate loops!\r\n");
+               break;
+            }
+            free (this->setpoint);
+            free (this->linked_channel);
+            this->linked_channel = linked;
+            this->size = size;
+            this->setpoint = data;
+            this->Kp = data + size;
+            this->Ki = data + 2 * size;
+            this->Kd = data + 3 * size;
+            this->input_min = data + 4 * size;
+            this->input_max = data + 5 * size;
+            this->output_min = data + 6 * size;
+            this->output_max = data + 7 * size;
+            this->previous_error = data + 8 * size;
+            this->integral = data + 9 * size;
+            this->output = data + 10 * size;
+
+            // default values :
+            for (i = 0; i < size; i++)
+            {
+               this->setpoint[i] = 0;
+               this->Kp[i] = 1.0;
+               this->Ki[i] = 0;
+               this->Kd[i] = 0;
+               this->input_min[i] = 0;
+               this->input_max[i] = 1;
+               this->output_min[i] = 0;
+               this->output_max[i] = 1;
+               this->previous_error[i] = 0;
+               this->integral[i] = 0;
+               this->output[i] = 0;
+            }
+         }
+      }
+      this->clock_channel = param_to_int (context, paramtype, param, 1);
+      for (i = 2; i < num_params && i - 2 < this->size; i++)
+      {
+         this->linked_channel[i - 2] =
+            param_to_int (context, paramtype, param, i);
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < this->size || this->size < 1)
+         break;
+      {
+         float time;
+         float inputs[this->size];
+         for (i = 0; i < this->size; i++)
+            inputs[i] = param_to_float (context, paramtype, param, i);
+
+         if (num_params > this->size)
+            time = pid_elapsed_time (context, this->clock_channel,
+                                     &this->last_time, 1,
+                                     param_to_timestamp (context, paramtype,
+                                                         param, this->size));
+         else
+            time = pid_elapsed_time (context, this->clock_channel,
+                                     &this->last_time, 0, 0);
+         pid_control_batch (this, inputs, time);
+
+         write_fv (context, linked_channels (context, id), 
+                   this->size, this->output);
+         if (this->linked_channel == NULL)
+            break;
+         for (i = 0; i < this->size; i++)
+         {
+            // Optional per loop output
+            if (this->linked_channel[i] != 0)
+               write_f (context, this->linked_channel[i], this->output[i]);
+         }
+      }
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      for (i = 0; i < this->size; i++)
+         return_float (context, returnv, this->output[i]);
+      break;
+   default:
+      break;
+   }
+}
+
+/////////////////////////////////////////////////
+// Cascade PID Controller Channel
+/////////////////////////////////////////////////
+struct cascade_data
+{
+   struct pid_type outer;
+   struct pid_type inner;
+   int ratio;          // Inner updates per outer update
+   int count;          // Inner updates since last outer update
+   float outer_dt;     // Time accumulated for next outer update
+   int clock_channel;
+   double last_time;
+};
+
+// Sets pid parameters from params: Kp Ki Kd inp_min inp_max out_min out_max
+void cascade_set_stage (struct pid_type *stage,
+                        const struct context_rmcios *context,
+                        enum type_rmcios paramtype, int num_params,
+                        const union param_rmcios param)
+{
+   if (num_params < 7)
+      return;
+   stage->Kp = param_to_float (context, paramtype, param, 0);
+   stage->Ki = param_to_float (context, paramtype, param, 1);
+   stage->Kd = param_to_float (context, paramtype, param, 2);
+   stage->input_min = param_to_float (context, paramtype, param, 3);
+   stage->input_max = param_to_float (context, paramtype, param, 4);
+   stage->output_min = param_to_float (context, paramtype, param, 5);
+   stage->output_max = param_to_float (context, paramtype, param, 6);
+}
+
+void cascade_outer_subchan_func (struct cascade_data *this,
+                                 const struct context_rmcios *context,
+                                 int id, enum function_rmcios function,
+                                 enum type_rmcios paramtype,
+                                 struct combo_rmcios *returnv,
+                                 int num_params,
+                                 const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      return_float (context, returnv, this->outer.output);
+      break;
+   case write_rmcios:
+      cascade_set_stage (&this->outer, context, paramtype, num_params, param);
+      break;
+   default:
+      break;
+   }
+}
+
+void cascade_inner_subchan_func (struct cascade_data *this,
+                                 const struct context_rmcios *context,
+                                 int id, enum function_rmcios function,
+                                 enum type_rmcios paramtype,
+                                 struct combo_rmcios *returnv,
+                                 int num_params,
+                                 const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      return_float (context, returnv, this->inner.setpoint);
+      break;
+   case write_rmcios:
+      cascade_set_stage (&this->inner, context, paramtype, num_params, param);
+      break;
+   default:
+      break;
+   }
+}
+
+void cascade_setp_subchan_func (struct cascade_data *this,
+                                const struct context_rmcios *context, int id,
+                                enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      return_float (context, returnv, this->outer.setpoint);
+      break;
+   case write_rmcios:
+      if (num_params < 1)
+         break;
+      this->outer.setpoint = param_to_float (context, paramtype, param, 0);
+      break;
+   default:
+      break;
+   }
+}
+
+void cascade_init_stage (struct pid_type *stage)
+{
+   stage->setpoint = 0;
+   stage->Kp = 1.0;
+   stage->Ki = 0;
+   stage->Kd = 0;
+   stage->input_min = 0;
+   stage->input_max = 1;
+   stage->output_min = 0;
+   stage->output_max = 1;
+   stage->previous_error = 0;
+   stage->integral = 0;
+   stage->output = 0;
+   stage->safe_output = 0;
+   stage->linked_channel = 0;
+   stage->clock_channel = 0;
+   stage->last_time = NAN;
+}
+
+void cascade_class_func (struct cascade_data *this,
+                         const struct context_rmcios *context, int id,
+                         enum function_rmcios function,
+                         enum type_rmcios paramtype,
+                         struct combo_rmcios *returnv,
+                         int num_params, const union param_rmcios param)
+{
+   float time;
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "cascade pid controller channel help\r\n"
+                     "Outer loop output is setpoint of the inner loop."
+                     " Both are updated in one write.\r\n"
+                     " create cascade newname \r\n"
+                     " setup newname setpoint | ratio clk_channel\r\n"
+                     "  -setpoint: setpoint of the outer loop\r\n"
+                     "  -ratio: inner updates per outer update (default 1)\r\n"
+                     "  -clk_channel 0 : use internal monotonic clock"
+                     " (default)\r\n"
+                     " write newname_outer Kp Ki Kd"
+                     " inp_min input_max output_min output_max\r\n"
+                     "  -outer output range is the inner setpoint range\r\n"
+                     " write newname_inner Kp Ki Kd"
+                     " inp_min input_max output_min output_max\r\n"
+                     " write newname outer_input inner_input | timestamp\r\n"
+                     "  -timestamp: time of the inputs in seconds"
+                     " with sub-ms precision. Used instead of clock\r\n"
+                     " read newname # read latest contol value\r\n"
+                     " read newname_outer # read outer loop output\r\n"
+                     " read newname_inner # read inner loop setpoint\r\n"
+                     " write newname_setpoint value # new outer setpoint\r\n"
+                     " link newname channel # link control to channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      // allocate new data
+      this = (struct cascade_data *)
+         allocate_storage (context, sizeof (struct cascade_data), 0);
+      if (this == NULL)
+         break;
+
+      // default values :
+      cascade_init_stage (&this->outer);
+      cascade_init_stage (&this->inner);
+      this->ratio = 1;
+      this->count = 0;
+      this->outer_dt = 0;
+      this->clock_channel = 0;
+      this->last_time = NAN;
+
+      // create channel
+      id = create_channel_param (context, paramtype, param, 0,
+                                 (class_rmcios) cascade_class_func, this);
+      create_subchannel_str (context, id, "_outer",
+                             (class_rmcios) cascade_outer_subchan_func, this);
+      create_subchannel_str (context, id, "_inner",
+                             (class_rmcios) cascade_inner_subchan_func, this);
+      create_subchannel_str (context, id, "_setpoint",
+                             (class_rmcios) cascade_setp_subchan_func, this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      this->outer.setpoint = param_to_float (context, paramtype, param, 0);
+      if (num_params < 2)
+         break;
+      this->ratio = param_to_int (context, paramtype, param, 1);
+      if (this->ratio < 1)
+         this->ratio = 1;
+      this->count = 0;
+      this->outer_dt = 0;
+      if (num_params < 3)
+         break;
+      this->clock_channel = param_to_int (context, paramtype, param, 2);
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+
+      if (num_params > 2)
+         time = pid_elapsed_time (context, this->clock_channel,
+                                  &this->last_time, 1,
+                                  param_to_timestamp (context, paramtype,
+                                                      param, 2));
+      else
+         time = pid_elapsed_time (context, this->clock_channel,
+                                  &this->last_time, 0, 0);
+
+      // Outer loop runs on every ratio:th update with the summed time.
+      this->outer_dt += time;
+      if (this->count == 0)
+      {
+         this->inner.setpoint =
+            pid_control (&this->outer,
+                         param_to_float (context, paramtype, param, 0),
+                         this->outer_dt);
+         this->outer_dt = 0;
+      }
+      if (++this->count >= this->ratio)
+         this->count = 0;
+
+      pid_control (&this->inner,
+                   param_to_float (context, paramtype, param, 1), time);
+      write_f (context, linked_channels (context, id), this->inner.output);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_float (context, returnv, this->inner.output);
+      break;
+   default:
+      break;
+   }
+}
+
+#ifdef __linux__
+/////////////////////////////////////////////////
+// Real-time executor channel
+/////////////////////////////////////////////////
+// Histogram bin i counts times in [2^(i-1), 2^i) microseconds. 
+// Bin 0 counts times below 1 microsecond.
+#define RTEXEC_HIST_BINS 24
+
+struct rtexec_histogram
+{
+   unsigned int bins[RTEXEC_HIST_BINS];
+   unsigned int count;
+   double min;
+   double max;
+   double sum;
+};
+
+struct rtexec_step
+{
+   int channel;
+   int num_values;
+   float *values;
+};
+
+struct rtexec_data
+{
+   int id;
+   double period;
+   int cpu;
+   int priority;
+
+   struct rtexec_step *steps;
+   int num_steps;
+   pthread_mutex_t lock;
+
+   pthread_t thread;
+   volatile int running;
+   const struct context_rmcios *context;
+
+   // Achieved environment
+   int realtime;
+   int memory_locked;
+
+   // Statistics
+   struct rtexec_histogram latency;
+   struct rtexec_histogram execution;
+   unsigned int cycles;
+   unsigned int missed;
+   unsigned int skipped;
+};
+
+void rtexec_histogram_reset (struct rtexec_histogram *h)
+{
+   memset (h->bins, 0, sizeof (h->bins));
+   h->count = 0;
+   h->min = 0;
+   h->max = 0;
+   h->sum = 0;
+}
+
+void rtexec_histogram_add (struct rtexec_histogram *h, double seconds)
+{
+   int bin = 0;
+   double us = seconds * 1e6;
+   while (us >= 1 && bin < RTEXEC_HIST_BINS - 1)
+   {
+      us /= 2;
+      bin++;
+   }
+   h->bins[bin]++;
+   if (h->count == 0 || seconds < h->min)
+      h->min = seconds;
+   if (h->count == 0 || seconds > h->max)
+      h->max = seconds;
+   h->sum += seconds;
+   h->count++;
+}
+
+void rtexec_stats_reset (struct rtexec_data *this)
+{
+   rtexec_histogram_reset (&this->latency);
+   rtexec_histogram_reset (&this->execution);
+   this->cycles = 0;
+   this->missed = 0;
+   this->skipped = 0;
+}
+
+double rtexec_timespec_diff (const struct timespec *a,
+                             const struct timespec *b)
+{
+   return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) * 1e-9;
+}
+
+void rtexec_timespec_add (struct timespec *t, long long ns)
+{
+   ns += t->tv_nsec;
+   t->tv_sec += ns / 1000000000LL;
+   t->tv_nsec = ns % 1000000000LL;
+}
+
+void *rtexec_thread (void *data)
+{
+   struct rtexec_data *this = data;
+   double period;
+   long long period_ns;
+   struct timespec deadline;
+   struct timespec now;
+   int i;
+
+   pthread_mutex_lock (&this->lock);
+   period = this->period;
+   pthread_mutex_unlock (&this->lock);
+   period_ns = period * 1e9;
+   clock_gettime (CLOCK_MONOTONIC, &deadline);
+   while (this->running)
+   {
+      rtexec_timespec_add (&deadline, period_ns);
+      while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                              NULL) != 0 && this->running);
+      if (!this->running)
+         break;
+      clock_gettime (CLOCK_MONOTONIC, &now);
+
+      pthread_mutex_lock (&this->lock);
+      rtexec_histogram_add (&this->latency,
+                            rtexec_timespec_diff (&now, &deadline));
+      for (i = 0; i < this->num_steps; i++)
+      {
+         struct rtexec_step *step = this->steps + i;
+         write_fv (this->context, step->channel, step->num_values,
+                   step->values);
+      }
+      {
+         struct timespec end;
+         double overrun;
+         clock_gettime (CLOCK_MONOTONIC, &end);
+         rtexec_histogram_add (&this->execution,
+                               rtexec_timespec_diff (&end, &now));
+         this->cycles++;
+
+         // Next deadline already passed: skip the periods that were lost 
+         overrun = rtexec_timespec_diff (&end, &deadline);
+         if (overrun >= period)
+         {
+            long long lost = overrun / period;
+            this->missed++;
+            this->skipped += lost;
+            rtexec_timespec_add (&deadline, lost * period_ns);
+         }
+      }
+      // Period changed by setup applies from the next cycle
+      if (this->period > 0)
+      {
+         period = this->period;
+         period_ns = period * 1e9;
+      }
+      pthread_mutex_unlock (&this->lock);
+   }
+   return NULL;
+}
+
+// Number of running executors holding the process wide memory lock.
+static int rtexec_memory_lockers = 0;
+
+void rtexec_attr_init (pthread_attr_t *attr, int cpu, int priority)
+{
+   pthread_attr_init (attr);
+   if (cpu >= 0)
+   {
+      cpu_set_t cpus;
+      CPU_ZERO (&cpus);
+      CPU_SET (cpu, &cpus);
+      pthread_attr_setaffinity_np (attr, sizeof (cpus), &cpus);
+   }
+   if (priority > 0)
+   {
+      struct sched_param sp;
+      sp.sched_priority = priority;
+      pthread_attr_setinheritsched (attr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy (attr, SCHED_FIFO);
+      pthread_attr_setschedparam (attr, &sp);
+   }
+}
+
+int rtexec_start (struct rtexec_data *this,
+                  const struct context_rmcios *context)
+{
+   pthread_attr_t attr;
+   int error;
+   int cpu = this->cpu;
+
+   if (this->running || this->period <= 0)
+      return -1;
+
+   this->context = context;
+   this->running = 1;
+   this->realtime = (this->priority > 0);
+   rtexec_attr_init (&attr, cpu, this->priority);
+   error = pthread_create (&this->thread, &attr, rtexec_thread, this);
+   pthread_attr_destroy (&attr);
+   if ((error == EPERM || error == EINVAL) && this->realtime)
+   {
+      // Real-time scheduling not permitted. Retry with normal priority.
+      this->realtime = 0;
+      rtexec_attr_init (&attr, cpu, 0);
+      error = pthread_create (&this->thread, &attr, rtexec_thread, this);
+      pthread_attr_destroy (&attr);
+      if (error == 0)
+         info (context, context->errors,
+               "rtexec: Real-time scheduling not available."
+               " Running with normal priority.\r\n");
+   }
+   if ((error == EPERM || error == EINVAL) && cpu >= 0)
+   {
+      // Cpu affinity rejected. Retry on any cpu.
+      cpu = -1;
+      rtexec_attr_init (&attr, cpu, this->priority);
+      this->realtime = (this->priority > 0);
+      error = pthread_create (&this->thread, &attr, rtexec_thread, this);
+      pthread_attr_destroy (&attr);
+      if ((error == EPERM || error == EINVAL) && this->realtime)
+      {
+         this->realtime = 0;
+         rtexec_attr_init (&attr, cpu, 0);
+         error = pthread_create (&this->thread, &attr, rtexec_thread, this);
+         pthread_attr_destroy (&attr);
+      }
+      if (error == 0)
+         info (context, context->errors,
+               this->realtime || this->priority <= 0 ?
+               "rtexec: Cpu affinity not available."
+               " Running on any cpu.\r\n" :
+               "rtexec: Cpu affinity and real-time scheduling"
+               " not available. Running on any cpu"
+               " with normal priority.\r\n");
+   }
+   if (error != 0)
+   {
+      this->running = 0;
+      this->realtime = 0;
+      info (context, context->errors, "rtexec: Could not start thread!\r\n");
+      return -1;
+   }
+
+   // Prevent page faults in the loop. Locks all memory of the process and
+   // requires privileges or memlock limit. Only done for real-time 
+   // executors and released when the last of them stops.
+   this->memory_locked = 0;
+   if (this->realtime)
+   {
+      if (rtexec_memory_lockers > 0
+          || mlockall (MCL_CURRENT | MCL_FUTURE) == 0)
+      {
+         rtexec_memory_lockers++;
+         this->memory_locked = 1;
+      }
+   }
+   return 0;
+}
+
+void rtexec_stop (struct rtexec_data *this)
+{
+   if (!this->running)
+      return;
+   this->running = 0;
+   pthread_join (this->thread, NULL);
+   if (this->memory_locked)
+   {
+      this->memory_locked = 0;
+      if (--rtexec_memory_lockers == 0)
+         munlockall ();
+   }
+}
+
+void rtexec_step_subchan_func (struct rtexec_data *this,
+                               const struct context_rmcios *context, int id,
+                               enum function_rmcios function,
+                               enum type_rmcios paramtype,
+                               struct combo_rmcios *returnv,
+                               int num_params,
+                               const union param_rmcios param)
+{
+   int i;
+   if (this == NULL)
+      return;
+   switch (function)
+   {
+   case read_rmcios:
+      return_int (context, returnv, this->num_steps);
+      break;
+   case write_rmcios:
+      pthread_mutex_lock (&this->lock);
+      if (num_params < 1)
+      {
+         // Clear the sequence
+         for (i = 0; i < this->num_steps; i++)
+            free (this->steps[i].values);
+         free (this->steps);
+         this->steps = NULL;
+         this->num_steps = 0;
+      }
+      else
+      {
+         struct rtexec_step *steps;
+         steps = realloc (this->steps,
+                          (this->num_steps + 1) * sizeof (*steps));
+         if (steps != NULL)
+         {
+            struct rtexec_step *step = steps + this->num_steps;
+            this->steps = steps;
+            step->channel = param_to_int (context, paramtype, param, 0);
+            step->num_values = num_params - 1;
+            step->values = NULL;
+            if (step->num_values > 0)
+            {
+               step->values = malloc (step->num_values * sizeof (float));
+               if (step->values == NULL)
+                  step->num_values = 0;
+            }
+            for (i = 0; i < step->num_values; i++)
+               step->values[i] =
+                  param_to_float (context, paramtype, param, i + 1);
+            this->num_steps++;
+         }
+      }
+      pthread_mutex_unlock (&this->lock);
+      break;
+   default:
+      break;
+   }
+}
+
+void rtexec_stats_subchan_func (struct rtexec_data *this,
+                                const struct context_rmcios *context, int id,
+                                enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   if (this == NULL)
+      return;
+   switch (function)
+   {
+   case read_rmcios:
+      pthread_mutex_lock (&this->lock);
+      if (num_params < 1)
+      {
+         return_int (context, returnv, this->cycles);
+         return_int (context, returnv, this->missed);
+         return_int (context, returnv, this->skipped);
+         return_float (context, returnv, this->latency.min);
+         return_float (context, returnv, this->latency.count > 0 ?
+                       this->latency.sum / this->latency.count : 0);
+         return_float (context, returnv, this->latency.max);
+         return_float (context, returnv, this->execution.min);
+         return_float (context, returnv, this->execution.count > 0 ?
+                       this->execution.sum / this->execution.count : 0);
+         return_float (context, returnv, this->execution.max);
+         return_int (context, returnv, this->realtime);
+         return_int (context, returnv, this->memory_locked);
+      }
+      else
+      {
+         struct rtexec_histogram *h = &this->latency;
+         char name[16];
+         int i;
+         name[0] = 0;
+         param_to_string (context, paramtype, param, 0, sizeof (name), name);
+         if (strcmp (name, "exec") == 0)
+            h = &this->execution;
+         for (i = 0; i < RTEXEC_HIST_BINS; i++)
+            return_int (context, returnv, h->bins[i]);
+      }
+      pthread_mutex_unlock (&this->lock);
+      break;
+   case write_rmcios:
+      // Reset statistics
+      pthread_mutex_lock (&this->lock);
+      rtexec_stats_reset (this);
+      pthread_mutex_unlock (&this->lock);
+      break;
+   default:
+      break;
+   }
+}
+
+void rtexec_class_func (struct rtexec_data *this,
+                        const struct context_rmcios *context, int id,
+                        enum function_rmcios function,
+                        enum type_rmcios paramtype,
+                        struct combo_rmcios *returnv,
+                        int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "real-time executor channel help\r\n"
+                     "Runs a sequence of channel writes at fixed period in"
+                     " a dedicated thread.\r\n"
+                     " create rtexec newname \r\n"
+                     " setup newname period | cpu priority\r\n"
+                     "  -period: in seconds. Applies from the next cycle"
+                     " when running\r\n"
+                     "  -cpu: cpu to run on. -1 for any (default)\r\n"
+                     "  -priority: SCHED_FIFO priority 1-99."
+                     " 0 for normal scheduling (default)\r\n"
+                     " write newname_step channel | values...\r\n"
+                     "  -append write of values to channel in sequence\r\n"
+                     " write newname_step # clear sequence\r\n"
+                     " read newname_step # number of steps\r\n"
+                     " write newname 1 # start\r\n"
+                     " write newname 0 # stop\r\n"
+                     " read newname # 1 when running\r\n"
+                     " read newname_stats \r\n"
+                     "  -returns: cycles missed skipped"
+                     " latency_min latency_mean latency_max"
+                     " exec_min exec_mean exec_max realtime memory_locked\r\n"
+                     " read newname_stats latency|exec\r\n"
+                     "  -histogram. Bin n counts times"
+                     " of 2^(n-1)...2^n us\r\n"
+                     " write newname_stats # reset statistics\r\n"
+                     "Falls back to normal scheduling or any cpu when"
+                     " real-time privileges or the cpu are not available."
+                     "\r\n"
+                     "Real-time executors lock all memory of the process"
+                     " (mlockall) while running.\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      this = (struct rtexec_data *)
+         allocate_storage (context, sizeof (struct rtexec_data), 0);
+      if (this == NULL)
+         break;
+      this->period = 0.01;
+      this->cpu = -1;
+      this->priority = 0;
+      this->steps = NULL;
+      this->num_steps = 0;
+      this->running = 0;
+      this->realtime = 0;
+      this->memory_locked = 0;
+      pthread_mutex_init (&this->lock, NULL);
+      rtexec_stats_reset (this);
+
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) rtexec_class_func,
+                                       this);
+      create_subchannel_str (context, this->id, "_step",
+                             (class_rmcios) rtexec_step_subchan_func, this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) rtexec_stats_subchan_func, this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      pthread_mutex_lock (&this->lock);
+      this->period = param_to_float (context, paramtype, param, 0);
+      pthread_mutex_unlock (&this->lock);
+      if (num_params >= 2)
+         this->cpu = param_to_int (context, paramtype, param, 1);
+      if (num_params >= 3)
+         this->priority = param_to_int (context, paramtype, param, 2);
+      break;
+
+   case write_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      if (param_to_int (context, paramtype, param, 0) != 0)
+         rtexec_start (this, context);
+      else
+         rtexec_stop (this);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_int (context, returnv, this->running);
+      break;
+
+   default:
+      break;
+   }
+}
+#endif
+
+/////////////////////////////////////////////////////////
+//! wait time reserved bus
+/////////////////////////////////////////////////////////
+#ifdef __linux__
+// Write waiting in the bus queue. Parameters are copied as buffers.
+struct delayed_bus_item
+{
+   struct delayed_bus_item *next;
+   int sender;
+   int priority;
+   double queued_time;
+   int num_params;
+   struct buffer_rmcios params[];
+};
+#endif
+
+struct delayed_bus_data
+{
+   float reserve_time;
+   int wait_channel;
+   int share_register;
+   int id;
+   int num_senders;
+
+#ifdef __linux__
+   // Queue mode
+   int queue_size;
+   int coalesce;
+   struct delayed_bus_item *queue;
+   int depth;
+   pthread_mutex_t lock;
+   pthread_cond_t queued;
+   pthread_t thread;
+   volatile int running;
+   const struct context_rmcios *context;
+
+   // Statistics
+   int max_depth;
+   unsigned int released;
+   unsigned int dropped;
+   unsigned int coalesced;
+   double wait_sum;
+   double wait_max;
+#endif
+};
+
+// Sender of a bus with own priority
+struct delayed_bus_lane
+{
+   struct delayed_bus_data *bus;
+   int sender;
+   int priority;
+};
+
+#ifdef __linux__
+struct delayed_bus_item *delayed_bus_item_new (const struct context_rmcios
+                                               *context,
+                                               enum type_rmcios paramtype,
+                                               int num_params,
+                                               const union param_rmcios param)
+{
+   struct delayed_bus_item *item;
+   size_t size = sizeof (*item) + num_params * sizeof (struct buffer_rmcios);
+   char *data;
+   int i;
+
+   for (i = 0; i < num_params; i++)
+      size += param_buffer_alloc_size (context, paramtype, param, i);
+   item = malloc (size);
+   if (item == NULL)
+      return NULL;
+
+   data = (char *) (item->params + num_params);
+   item->num_params = num_params;
+   for (i = 0; i < num_params; i++)
+   {
+      int plen = param_buffer_alloc_size (context, paramtype, param, i);
+      struct buffer_rmcios b;
+      b = param_to_buffer (context, paramtype, param, i, plen, data);
+      if (b.data != data)
+         memmove (data, b.data, b.length);
+      item->params[i].data = data;
+      item->params[i].length = b.length;
+      item->params[i].size = b.length;
+      item->params[i].required_size = b.length;
+      item->params[i].trailing_size = 0;
+      data += plen;
+   }
+   return item;
+}
+
+// Insert write to queue. Higher priority first, same priority in order.
+// Returns 0 when queued, -1 when dropped.
+int delayed_bus_enqueue (struct delayed_bus_data *this,
+                         const struct context_rmcios *context,
+                         int sender, int priority,
+                         enum type_rmcios paramtype, int num_params,
+                         const union param_rmcios param)
+{
+   struct delayed_bus_item *item;
+   struct delayed_bus_item **pos;
+
+   item = delayed_bus_item_new (context, paramtype, num_params, param);
+   if (item == NULL)
+      return -1;
+   item->sender = sender;
+   item->priority = priority;
+   item->queued_time = monotonic_time ();
+
+   pthread_mutex_lock (&this->lock);
+   // Anonymous writes (sender 0) come from unrelated callers and are
+   // never coalesced.
+   if (this->coalesce && sender != 0)
+   {
+      // Replace pending write of the same sender, keeping its place.
+      for (pos = &this->queue; *pos != NULL; pos = &(*pos)->next)
+      {
+         if ((*pos)->sender == sender)
+         {
+            struct delayed_bus_item *old = *pos;
+            item->next = old->next;
+            item->queued_time = old->queued_time;
+            *pos = item;
+            free (old);
+            this->coalesced++;
+            pthread_mutex_unlock (&this->lock);
+            return 0;
+         }
+      }
+   }
+   if (this->depth >= this->queue_size)
+   {
+      this->dropped++;
+      pthread_mutex_unlock (&this->lock);
+      free (item);
+      return -1;
+   }
+   for (pos = &this->queue; *pos != NULL; pos = &(*pos)->next)
+   {
+      if ((*pos)->priority < priority)
+         break;
+   }
+   item->next = *pos;
+   *pos = item;
+   this->depth++;
+   if (this->depth > this->max_depth)
+      this->max_depth = this->depth;
+   pthread_cond_signal (&this->queued);
+   pthread_mutex_unlock (&this->lock);
+   return 0;
+}
+
+void *delayed_bus_thread (void *data)
+{
+   struct delayed_bus_data *this = data;
+   struct delayed_bus_item *item;
+   struct timespec ts;
+   double wait;
+
+   pthread_mutex_lock (&this->lock);
+   while (this->running)
+   {
+      if (this->queue == NULL)
+      {
+         pthread_cond_wait (&this->queued, &this->lock);
+         continue;
+      }
+      item = this->queue;
+      this->queue = item->next;
+      this->depth--;
+      wait = monotonic_time () - item->queued_time;
+      this->wait_sum += wait;
+      if (wait > this->wait_max)
+         this->wait_max = wait;
+      this->released++;
+      pthread_mutex_unlock (&this->lock);
+
+      // Pass write command to linked channels
+      run_channel (this->context, linked_channels (this->context, this->id),
+                   write_rmcios, buffer_rmcios, 0, item->num_params,
+                   (const union param_rmcios) item->params);
+      free (item);
+
+      // Reserve the bus. Only the scheduler waits.
+      ts.tv_sec = this->reserve_time;
+      ts.tv_nsec = (this->reserve_time - ts.tv_sec) * 1e9;
+      if (this->reserve_time > 0)
+         nanosleep (&ts, NULL);
+
+      pthread_mutex_lock (&this->lock);
+   }
+   pthread_mutex_unlock (&this->lock);
+   return NULL;
+}
+
+void delayed_bus_stop (struct delayed_bus_data *this)
+{
+   struct delayed_bus_item *item;
+   if (!this->running)
+      return;
+   pthread_mutex_lock (&this->lock);
+   this->running = 0;
+   pthread_cond_signal (&this->queued);
+   pthread_mutex_unlock (&this->lock);
+   pthread_join (this->thread, NULL);
+
+   // Release pending writes as blocking writes
+   while (this->queue != NULL)
+   {
+      item = this->queue;
+      this->queue = item->next;
+      this->depth--;
+      this->released++;
+      run_channel (this->context, linked_channels (this->context, this->id),
+                   write_rmcios, buffer_rmcios, 0, item->num_params,
+                   (const union param_rmcios) item->params);
+      free (item);
+      write_f (this->context, this->wait_channel, this->reserve_time);
+   }
+}
+
+void delayed_bus_start (struct delayed_bus_data *this,
+                        const struct context_rmcios *context)
+{
+   if (this->running)
+      return;
+   this->context = context;
+   this->running = 1;
+   if (pthread_create (&this->thread, NULL, delayed_bus_thread, this) != 0)
+   {
+      this->running = 0;
+      info (context, context->errors,
+            "bus: Could not start scheduler. Using blocking writes.\r\n");
+   }
+}
+
+void delayed_bus_stats_subchan_func (struct delayed_bus_data *this,
+                                     const struct context_rmcios *context,
+                                     int id, enum function_rmcios function,
+                                     enum type_rmcios paramtype,
+                                     struct combo_rmcios *returnv,
+                                     int num_params,
+                                     const union param_rmcios param)
+{
+   if (this == NULL)
+      return;
+   pthread_mutex_lock (&this->lock);
+   switch (function)
+   {
+   case read_rmcios:
+      return_int (context, returnv, this->depth);
+      return_int (context, returnv, this->max_depth);
+      return_int (context, returnv, this->released);
+      return_int (context, returnv, this->dropped);
+      return_int (context, returnv, this->coalesced);
+      return_float (context, returnv, this->released > 0 ?
+                    this->wait_sum / this->released : 0);
+      return_float (context, returnv, this->wait_max);
+      break;
+   case write_rmcios:
+      // Reset statistics
+      this->max_depth = this->depth;
+      this->released = 0;
+      this->dropped = 0;
+      this->coalesced = 0;
+      this->wait_sum = 0;
+      this->wait_max = 0;
+      break;
+   default:
+      break;
+   }
+   pthread_mutex_unlock (&this->lock);
+}
+#endif
+
+// Pass write to the bus from sender with priority
+void delayed_bus_write (struct delayed_bus_data *this,
+                        const struct context_rmcios *context,
+                        int sender, int priority,
+                        enum type_rmcios paramtype,
+                        struct combo_rmcios *returnv,
+                        int num_params, const union param_rmcios param)
+{
+#ifdef __linux__
+   if (this->running)
+   {
+      delayed_bus_enqueue (this, context, sender, priority,
+                           paramtype, num_params, param);
+      return;
+   }
+#endif
+   // Pass write command to linked channels
+   run_channel (context, linked_channels (context, this->id),
+                write_rmcios, paramtype, returnv, num_params, param);
+
+   // Wait for specified time
+   write_f (context, this->wait_channel, this->reserve_time);
+}
+
+void delayed_bus_lane_subchan_func (struct delayed_bus_lane *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   switch (function)
+   {
+   case write_rmcios:
+      delayed_bus_write (this->bus, context, this->sender, this->priority,
+                         paramtype, returnv, num_params, param);
+      break;
+   case read_rmcios:
+      return_int (context, returnv, this->priority);
+      break;
+   default:
+      break;
+   }
+}
+
+// Creates new sender subchannel for the bus
+void delayed_bus_addlane_subchan_func (struct delayed_bus_data *this,
+                                       const struct context_rmcios *context,
+                                       int id, enum function_rmcios function,
+                                       enum type_rmcios paramtype,
+                                       struct combo_rmcios *returnv,
+                                       int num_params,
+                                       const union param_rmcios param)
+{
+   struct delayed_bus_lane *lane;
+   if (this == NULL || function != write_rmcios || num_params < 1)
+      return;
+   lane = (struct delayed_bus_lane *)
+      allocate_storage (context, sizeof (struct delayed_bus_lane), 0);
+   if (lane == NULL)
+      return;
+   lane->bus = this;
+   lane->sender = ++this->num_senders;
+   lane->priority = 0;
+   if (num_params > 1)
+      lane->priority = param_to_int (context, paramtype, param, 1);
+   {
+      int namelen = param_string_alloc_size (context, paramtype, param, 0);
+      char name[namelen + 1];
+      name[0] = '_';
+      param_to_string (context, paramtype, param, 0, namelen, name + 1);
+      create_subchannel_str (context, this->id, name,
+                             (class_rmcios) delayed_bus_lane_subchan_func,
+                             lane);
+   }
+}
+
+// timeslot sharing of linked channels
 void delayed_bus_class_func (struct delayed_bus_data *this,
                              const struct context_rmcios *context, int id,
                              enum function_rmcios function,
@@ -459,8 +2298,25 @@ void delayed_bus_class_func (struct delayed_bus_data *this,
                      " and waits for a fixed time.\r\n"
                      "Only single entry to the bus can be done at a time.\r\n"
                      " create bus newname\r\n"
-                     " setup newname reserve_time | wait_channel(wait)\r\n"
+                     " setup newname reserve_time | wait_channel(wait)"
+                     " queue_size coalesce\r\n"
+                     "  -queue_size: >0 queues writes and returns at once."
+                     " Scheduler thread releases them reserve_time apart."
+                     " (linux)\r\n"
+                     "   0 stops the scheduler after releasing queued"
+                     " writes\r\n"
+                     "  -coalesce: 1 replaces queued write of the same"
+                     " sender subchannel with the newer one."
+                     " Direct writes are not coalesced\r\n"
                      " write newname data\r\n"
+                     " write newname_lane name | priority\r\n"
+                     "  -create sender subchannel newname_name."
+                     " Higher priority is released first\r\n"
+                     " write newname_name data # write as the sender\r\n"
+                     " read newname_stats\r\n"
+                     "  -returns: depth max_depth released dropped"
+                     " coalesced wait_mean wait_max\r\n"
+                     " write newname_stats # reset statistics\r\n"
                      " link newname channel"
                      " #link bus to data transport channel\r\n");
       break;
@@ -472,15 +2328,42 @@ void delayed_bus_class_func (struct delayed_bus_data *this,
          this = (struct delayed_bus_data *) 
                  allocate_storage (context, sizeof (struct delayed_bus_data), 0);
       if (this == NULL)
+      {
          info (context, context->errors, "Could not create delayed bus!\r\n");
+         break;
+      }
 
       this->reserve_time = 1;
       this->wait_channel = channel_enum (context, "wait");
       this->share_register = 0;
+      this->num_senders = 0;
+#ifdef __linux__
+      this->queue_size = 0;
+      this->coalesce = 0;
+      this->queue = NULL;
+      this->depth = 0;
+      this->running = 0;
+      this->max_depth = 0;
+      this->released = 0;
+      this->dropped = 0;
+      this->coalesced = 0;
+      this->wait_sum = 0;
+      this->wait_max = 0;
+      pthread_mutex_init (&this->lock, NULL);
+      pthread_cond_init (&this->queued, NULL);
+#endif
       
       // create channel
-      create_channel_param (context, paramtype, param, 0, 
+      this->id = create_channel_param (context, paramtype, param, 0, 
                             (class_rmcios) delayed_bus_class_func, this); 
+      create_subchannel_str (context, this->id, "_lane",
+                             (class_rmcios) delayed_bus_addlane_subchan_func,
+                             this);
+#ifdef __linux__
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) delayed_bus_stats_subchan_func,
+                             this);
+#endif
       break;
 
    case setup_rmcios:
@@ -492,19 +2375,30 @@ void delayed_bus_class_func (struct delayed_bus_data *this,
       if (num_params < 2)
          break;
       this->wait_channel = param_to_int (context, paramtype, param, 1);
+      if (num_params < 3)
+         break;
+#ifdef __linux__
+      // Running scheduler keeps its queue. New size applies to new writes.
+      pthread_mutex_lock (&this->lock);
+      this->queue_size = param_to_int (context, paramtype, param, 2);
+      if (num_params >= 4)
+         this->coalesce = param_to_int (context, paramtype, param, 3);
+      pthread_mutex_unlock (&this->lock);
+      if (this->queue_size > 0)
+         delayed_bus_start (this, context);
+      else
+         delayed_bus_stop (this);
+#else
+      info (context, context->errors,
+            "bus: Queue not supported. Using blocking writes.\r\n");
+#endif
       break;
 
    case write_rmcios:
       if (this == NULL)
          break;
-      
-      // Pass write command to linked channels
-      run_channel (context, linked_channels (context, id),
-                            write_rmcios, paramtype, returnv, num_params,
-                            param);
-      
-      // Wait for specified time
-      write_f (context, this->wait_channel, this->reserve_time);
+      delayed_bus_write (this, context, 0, 0, paramtype, returnv,
+                         num_params, param);
       break;
    }
 }
@@ -515,7 +2409,16 @@ void init_std_control_channels (const struct context_rmcios *context)
    create_channel_str (context, "ramp", (class_rmcios) ramp_class_func, NULL);
    create_channel_str (context, "timerpwm",
                        (class_rmcios) timerpwm_class_func, NULL);
+   create_channel_str (context, "pwm", (class_rmcios) pwm_class_func, NULL);
    create_channel_str (context, "pid", (class_rmcios) pid_class_func, NULL);
+   create_channel_str (context, "pidbatch", 
+                       (class_rmcios) pid_batch_class_func, NULL);
+   create_channel_str (context, "cascade", 
+                       (class_rmcios) cascade_class_func, NULL);
+#ifdef __linux__
+   create_channel_str (context, "rtexec", (class_rmcios) rtexec_class_func,
+                       NULL);
+#endif
    create_channel_str (context, "bus", (class_rmcios) delayed_bus_class_func,
                        NULL);
 }
@@ -32,11 +32,27 @@ along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
  *
  * Changelog: (date,who,description) */
 
+#ifdef __linux__
+// posix_openpt, ptsname_r, cfmakeraw
+#define _GNU_SOURCE
+#endif
+
 #include "RMCIOS-functions.h"
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "monotonic_time.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#endif
 
 /////////////////////////////////////////////////
 // TSI 4000 series flowmeter channel
@@ -477,6 +493,30 @@ void pt_temperature_class_func (struct pt_temperature_data *this,
 //////////////////////////////////////////////////////////////
 //! Concentration scaling channel
 //////////////////////////////////////////////////////////////
+struct conc_sample
+{
+   float counts;
+   float elapsed;       // unit: s
+   float volume;        // unit: cm^3
+};
+
+// Moving window over the sample ring. Sums are updated on every sample
+// push and on every eviction, so the cost per sample does not depend
+// on the window length.
+struct conc_window
+{
+   float length;        // unit: s
+   int tail;            // index of the oldest sample in the window
+   int num_samples;
+   double counts;
+   double elapsed;
+   double volume;
+};
+
+#define CONC_MAX_WINDOWS 8
+// Automatic ring grows up to this many samples
+#define CONC_MAX_RING 65536
+
 struct conc_data
 {
    int timer_channel;
@@ -485,8 +525,242 @@ struct conc_data
 
    // Concentration calculation values
    float sample_flow; //unit: cm^3/s
+
+   // Sliding window concentrations
+   int window_channel;
+   struct conc_sample *samples;
+   int ring_size;
+   int ring_fixed;      // ring_size given in setup. Otherwise grows.
+   int ring_warned;     // Short ring has been reported
+   int head;            // index of the next sample to be written
+   int num_windows;
+   struct conc_window windows[CONC_MAX_WINDOWS];
 };
 
+float conc_window_value (struct conc_window *w)
+{
+   if (w->num_samples == 0 || w->volume == 0)
+      return NAN;
+   return w->counts / w->volume;
+}
+
+void conc_window_evict (struct conc_data *this, struct conc_window *w)
+{
+   struct conc_sample *s = this->samples + w->tail;
+   w->counts -= s->counts;
+   w->elapsed -= s->elapsed;
+   w->volume -= s->volume;
+   w->num_samples--;
+   if (++w->tail == this->ring_size)
+      w->tail = 0;
+   if (w->num_samples == 0)
+   {
+      // Clear accumulated rounding error
+      w->counts = 0;
+      w->elapsed = 0;
+      w->volume = 0;
+   }
+}
+
+void conc_window_reset (struct conc_data *this)
+{
+   int i;
+   this->head = 0;
+   for (i = 0; i < this->num_windows; i++)
+   {
+      this->windows[i].tail = 0;
+      this->windows[i].num_samples = 0;
+      this->windows[i].counts = 0;
+      this->windows[i].elapsed = 0;
+      this->windows[i].volume = 0;
+   }
+}
+
+// Double the ring. Samples are moved so that the oldest is first.
+int conc_window_grow (struct conc_data *this)
+{
+   int size = this->ring_size * 2;
+   struct conc_sample *samples;
+   int i;
+   if (size > CONC_MAX_RING)
+      return -1;
+   samples = malloc (size * sizeof (struct conc_sample));
+   if (samples == NULL)
+      return -1;
+   for (i = 0; i < this->ring_size; i++)
+      samples[i] = this->samples[(this->head + i) % this->ring_size];
+   for (i = 0; i < this->num_windows; i++)
+   {
+      struct conc_window *w = this->windows + i;
+      w->tail = (w->tail - this->head + this->ring_size) % this->ring_size;
+   }
+   free (this->samples);
+   this->samples = samples;
+   this->head = this->ring_size;
+   this->ring_size = size;
+   return 0;
+}
+
+// Push new (counts, elapsed time, flow) sample to the sliding windows
+void conc_window_push (struct conc_data *this,
+                       const struct context_rmcios *context, float counts,
+                       float elapsed, float sample_flow)
+{
+   struct conc_sample *s;
+   int i;
+   if (this->samples == NULL || this->ring_size < 1)
+      return;
+   if (!(elapsed > 0))
+      return;
+
+   // Make room: evict the sample about to be overwritten.
+   for (i = 0; i < this->num_windows; i++)
+   {
+      struct conc_window *w = this->windows + i;
+      if (w->num_samples == 0 || w->num_samples < this->ring_size)
+         continue;
+      // Ring holds less than the window length
+      if (w->elapsed - this->samples[w->tail].elapsed < w->length)
+      {
+         if (!this->ring_fixed && conc_window_grow (this) == 0)
+            break;
+         if (!this->ring_warned)
+         {
+            info (context, context->errors,
+                  "conc: Sample ring is too short for window length."
+                  " Increase ring_size.\r\n");
+            this->ring_warned = 1;
+         }
+      }
+      conc_window_evict (this, w);
+   }
+
+   s = this->samples + this->head;
+   s->counts = counts;
+   s->elapsed = elapsed;
+   s->volume = elapsed * sample_flow;
+   if (++this->head == this->ring_size)
+      this->head = 0;
+
+   for (i = 0; i < this->num_windows; i++)
+   {
+      struct conc_window *w = this->windows + i;
+      w->counts += s->counts;
+      w->elapsed += s->elapsed;
+      w->volume += s->volume;
+      w->num_samples++;
+
+      // Drop oldest samples while the rest still cover the window length
+      while (w->num_samples > 1
+             && w->elapsed - this->samples[w->tail].elapsed >= w->length)
+      {
+         conc_window_evict (this, w);
+      }
+   }
+}
+
+void conc_window_subchan_func (struct conc_data *this,
+                               const struct context_rmcios *context, int id,
+                               enum function_rmcios function,
+                               enum type_rmcios paramtype,
+                               struct combo_rmcios *returnv,
+                               int num_params, const union param_rmcios param)
+{
+   int i;
+   switch (function)
+   {
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+      {
+         conc_window_reset (this);
+         break;
+      }
+      {
+         int ring_size = param_to_int (context, paramtype, param, 0);
+         if (ring_size < 0)
+            break;
+         // 0 grows the ring automatically to cover the windows
+         this->ring_fixed = (ring_size > 0);
+         this->ring_warned = 0;
+         if (ring_size == 0)
+            ring_size = 128;
+         if (ring_size != this->ring_size)
+         {
+            struct conc_sample *samples;
+            samples = malloc (ring_size * sizeof (struct conc_sample));
+            if (samples == NULL)
+            {
+               info (context, context->errors,
+                     "conc: Could not allocate sample ring!\r\n");
+               break;
+            }
+            if (this->samples != NULL)
+               free (this->samples);
+            this->samples = samples;
+            this->ring_size = ring_size;
+         }
+      }
+      if (num_params > 1)
+      {
+         this->num_windows = num_params - 1;
+         if (this->num_windows > CONC_MAX_WINDOWS)
+            this->num_windows = CONC_MAX_WINDOWS;
+         for (i = 0; i < this->num_windows; i++)
+         {
+            this->windows[i].length =
+               param_to_float (context, paramtype, param, i + 1);
+         }
+      }
+      conc_window_reset (this);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params > 0)
+      {
+         i = param_to_int (context, paramtype, param, 0);
+         if (i >= 0 && i < this->num_windows)
+            return_float (context, returnv,
+                          conc_window_value (this->windows + i));
+         break;
+      }
+      for (i = 0; i < this->num_windows; i++)
+      {
+         return_float (context, returnv,
+                       conc_window_value (this->windows + i));
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      {
+         float sample_flow = this->sample_flow;
+         float values[CONC_MAX_WINDOWS];
+         if (num_params > 2)
+            sample_flow =
+               param_to_float (context, paramtype, param, 2) * 16.6666667;
+         conc_window_push (this, context,
+                           param_to_float (context, paramtype, param, 0),
+                           param_to_float (context, paramtype, param, 1),
+                           sample_flow);
+         for (i = 0; i < this->num_windows; i++)
+            values[i] = conc_window_value (this->windows + i);
+         write_fv (context, linked_channels (context, id),
+                   this->num_windows, values);
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
 void conc_class_func (struct conc_data *this,
                       const struct context_rmcios *context, int id,
                       enum function_rmcios function,
@@ -505,7 +779,22 @@ void conc_class_func (struct conc_data *this,
                      " | 3=sample_flow_channel\r\n"
                      "read conc #calculate and read the concentration\r\n"
                      "write conc #empty write clear counter"
-                     " and timer for concentration\r\n");
+                     " and timer for concentration\r\n"
+                     "  -Each write also pushes the counts, elapsed time and"
+                     " flow to the sliding windows\r\n"
+                     "setup conc_window ring_size | window_length(s)...\r\n"
+                     "  -Set number of stored samples and window lengths.\r\n"
+                     "  -ring_size 0: grow as needed to cover the longest"
+                     " window (default)\r\n"
+                     "  -Default windows are 1s, 10s and 60s\r\n"
+                     "setup conc_window #clear the windows\r\n"
+                     "read conc_window | index\r\n"
+                     "  -read window concentrations without accessing"
+                     " counter, timer or flow channels\r\n"
+                     "write conc_window counts elapsed_time | flow(l/min)\r\n"
+                     "  -push sample to the windows\r\n"
+                     "link conc_window channel\r\n"
+                     "  -send window concentrations as vector on update\r\n");
       break;
 
    case create_rmcios:
@@ -517,17 +806,37 @@ void conc_class_func (struct conc_data *this,
          this = (struct conc_data *) 
                 allocate_storage (context, sizeof (struct conc_data), 0);  
          if (this == NULL)
+         {
             info (context, context->errors, "Could not create conc!\r\n");
+            break;
+         }
          
          // create channel
-         create_channel_param (context, paramtype, param, 0, 
-                               (class_rmcios) conc_class_func, this); 
+         id = create_channel_param (context, paramtype, param, 0, 
+                                    (class_rmcios) conc_class_func, this); 
+         this->window_channel =
+            create_subchannel_str (context, id, "_window",
+                                   (class_rmcios) conc_window_subchan_func,
+                                   this);
       }
 
       this->sample_flow = 0;
       this->counter_channel = 0;
       this->timer_channel = 0;
       this->sample_flow_channel = 0;
+
+      // Default windows: 1s, 10s and 60s
+      this->ring_size = 128;
+      this->ring_fixed = 0;
+      this->ring_warned = 0;
+      this->samples = malloc (this->ring_size * sizeof (struct conc_sample));
+      if (this->samples == NULL)
+         this->ring_size = 0;
+      this->num_windows = 3;
+      this->windows[0].length = 1;
+      this->windows[1].length = 10;
+      this->windows[2].length = 60;
+      conc_window_reset (this);
       break;
 
    case setup_rmcios:  
@@ -568,12 +877,26 @@ void conc_class_func (struct conc_data *this,
             read_f (context, this->sample_flow_channel) * 16.6666667;
       {
          float conc;
-         conc =
-            write_fv (context, this->counter_channel, 0,
-                      NULL) / write_fv (context, this->timer_channel, 0,
-                                        NULL) / this->sample_flow;
+         float counts;
+         float elapsed;
+         counts = write_fv (context, this->counter_channel, 0, NULL);
+         elapsed = write_fv (context, this->timer_channel, 0, NULL);
+         conc = counts / elapsed / this->sample_flow;
          write_f (context, linked_channels (context, id), conc);
          return_float (context, returnv, conc);
+
+         // Update the sliding windows from the same sample
+         if (this->num_windows > 0)
+         {
+            float values[CONC_MAX_WINDOWS];
+            int i;
+            conc_window_push (this, context, counts, elapsed,
+                              this->sample_flow);
+            for (i = 0; i < this->num_windows; i++)
+               values[i] = conc_window_value (this->windows + i);
+            write_fv (context, linked_channels (context, this->window_channel),
+                      this->num_windows, values);
+         }
       }
       break;
    }
@@ -582,18 +905,483 @@ void conc_class_func (struct conc_data *this,
 ///////////////////////////////////////////////////////////
 // Modbus RTU
 ///////////////////////////////////////////////////////////
+
+// Maximum RTU frame: address + PDU(253) + CRC
+#define MODBUS_RTU_MAX_ADU 256
+// Maximum number of registers in single read (function 3/4)
+#define MODBUS_MAX_READ_REGISTERS 125
+// Maximum number of registers in single write (function 16)
+#define MODBUS_MAX_WRITE_REGISTERS 123
+
+enum modbus_value_type
+{
+   modbus_u16,
+   modbus_s16,
+   modbus_u32,
+   modbus_s32,
+   modbus_f32,
+   // 32bit values with low word first
+   modbus_u32_swapped,
+   modbus_s32_swapped,
+   modbus_f32_swapped
+};
+
 struct modbus_rtu_data
 {
+   int id;
+   int rx_channel;
    int communication_channel;
-   char address;
-   char function;
-   int crc;
-   int datalen;
-   char *data;
-   int linked_channels;
+   int wait_channel;
+   unsigned char address;
+   unsigned char function;
+   enum modbus_value_type type;
+
+   // Frame timing
+   float char_time;     // s, transmission time of one 11bit character
+   float frame_gap;     // s, 3.5 character silent interval
+   float timeout;       // s, reply timeout
+
+   // Reception (filled by the _rx subchannel)
+   unsigned char rx[MODBUS_RTU_MAX_ADU];
+   int rx_length;
+   double rx_time;
+   unsigned char reply[MODBUS_RTU_MAX_ADU];   // Completed frame
+#ifdef __linux__
+   // Reception is shared with the receiving thread of the transport
+   pthread_mutex_t lock;
+#endif
+
+   // Transmission
+   unsigned char tx[MODBUS_RTU_MAX_ADU];
+   double tx_time;
+
+   // Error counters
+   int crc_errors;
+   int timeouts;
+   int exceptions;
 };
 
-void modbus_rtu_class_func (struct conc_data *this,
+void modbus_rtu_lock (struct modbus_rtu_data *this)
+{
+#ifdef __linux__
+   pthread_mutex_lock (&this->lock);
+#endif
+}
+
+void modbus_rtu_unlock (struct modbus_rtu_data *this)
+{
+#ifdef __linux__
+   pthread_mutex_unlock (&this->lock);
+#endif
+}
+
+// CRC-16/MODBUS lookup tables for slicing-by-4
+static unsigned short modbus_crc_table[4][256];
+
+void modbus_crc_init (void)
+{
+   int i, j;
+   for (i = 0; i < 256; i++)
+   {
+      unsigned short crc = i;
+      for (j = 0; j < 8; j++)
+         crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+      modbus_crc_table[0][i] = crc;
+   }
+   for (i = 0; i < 256; i++)
+   {
+      for (j = 1; j < 4; j++)
+      {
+         unsigned short crc = modbus_crc_table[j - 1][i];
+         modbus_crc_table[j][i] =
+            (crc >> 8) ^ modbus_crc_table[0][crc & 0xff];
+      }
+   }
+}
+
+unsigned short modbus_crc16 (const unsigned char *data, int length)
+{
+   unsigned short crc = 0xFFFF;
+
+   // 4 bytes per round
+   while (length >= 4)
+   {
+      crc ^= data[0] | (data[1] << 8);
+      crc = modbus_crc_table[3][crc & 0xff]
+         ^ modbus_crc_table[2][crc >> 8]
+         ^ modbus_crc_table[1][data[2]] 
+         ^ modbus_crc_table[0][data[3]];
+      data += 4;
+      length -= 4;
+   }
+   while (length--)
+      crc = (crc >> 8) ^ modbus_crc_table[0][(crc ^ *data++) & 0xff];
+   return crc;
+}
+
+// Number of registers used by single value of the type
+int modbus_type_registers (enum modbus_value_type type)
+{
+   return (type == modbus_u16 || type == modbus_s16) ? 1 : 2;
+}
+
+enum modbus_value_type modbus_type_from_string (const char *s)
+{
+   if (strcmp (s, "s16") == 0)
+      return modbus_s16;
+   if (strcmp (s, "u32") == 0)
+      return modbus_u32;
+   if (strcmp (s, "s32") == 0)
+      return modbus_s32;
+   if (strcmp (s, "f32") == 0)
+      return modbus_f32;
+   if (strcmp (s, "u32sw") == 0)
+      return modbus_u32_swapped;
+   if (strcmp (s, "s32sw") == 0)
+      return modbus_s32_swapped;
+   if (strcmp (s, "f32sw") == 0)
+      return modbus_f32_swapped;
+   return modbus_u16;
+}
+
+// Decode typed value directly from big-endian register data.
+float modbus_register_value (const unsigned char *data,
+                             enum modbus_value_type type)
+{
+   union
+   {
+      uint32_t u;
+      float f;
+   } value;
+
+   switch (type)
+   {
+   case modbus_u16:
+      return (uint16_t) (data[0] << 8 | data[1]);
+   case modbus_s16:
+      return (int16_t) (data[0] << 8 | data[1]);
+   case modbus_u32_swapped:
+   case modbus_s32_swapped:
+   case modbus_f32_swapped:
+      value.u = (uint32_t) data[2] << 24 | (uint32_t) data[3] << 16
+                | (uint32_t) data[0] << 8 | data[1];
+      break;
+   default:
+      value.u = (uint32_t) data[0] << 24 | (uint32_t) data[1] << 16
+                | (uint32_t) data[2] << 8 | data[3];
+      break;
+   }
+
+   switch (type)
+   {
+   case modbus_s32:
+   case modbus_s32_swapped:
+      return (int32_t) value.u;
+   case modbus_f32:
+   case modbus_f32_swapped:
+      return value.f;
+   default:
+      return value.u;
+   }
+}
+
+// Encode typed value to big-endian register data. Returns bytes written.
+int modbus_encode_value (unsigned char *data, float v,
+                         enum modbus_value_type type)
+{
+   union
+   {
+      uint32_t u;
+      float f;
+   } value;
+
+   switch (type)
+   {
+   case modbus_u16:
+      value.u = (uint16_t) lrintf (v);
+      data[0] = value.u >> 8;
+      data[1] = value.u;
+      return 2;
+   case modbus_s16:
+      value.u = (uint16_t) (int16_t) lrintf (v);
+      data[0] = value.u >> 8;
+      data[1] = value.u;
+      return 2;
+   case modbus_f32:
+   case modbus_f32_swapped:
+      value.f = v;
+      break;
+   case modbus_s32:
+   case modbus_s32_swapped:
+      value.u = (uint32_t) (int32_t) llrintf (v);
+      break;
+   default:
+      value.u = (uint32_t) llrintf (v);
+      break;
+   }
+
+   if (type == modbus_u32_swapped || type == modbus_s32_swapped
+       || type == modbus_f32_swapped)
+   {
+      data[0] = value.u >> 8;
+      data[1] = value.u;
+      data[2] = value.u >> 24;
+      data[3] = value.u >> 16;
+   }
+   else
+   {
+      data[0] = value.u >> 24;
+      data[1] = value.u >> 16;
+      data[2] = value.u >> 8;
+      data[3] = value.u;
+   }
+   return 4;
+}
+
+void modbus_rtu_set_baudrate (struct modbus_rtu_data *this, float baudrate)
+{
+   if (!(baudrate > 0))
+      return;
+   // 1 start bit, 8 data bits, parity/2nd stop bit, stop bit
+   this->char_time = 11.0 / baudrate;
+   if (baudrate > 19200)
+      // Fixed inter-frame delay for high baudrates
+      this->frame_gap = 0.00175;
+   else
+      this->frame_gap = 3.5 * this->char_time;
+}
+
+// Default values for the master
+void modbus_rtu_init (struct modbus_rtu_data *this,
+                      const struct context_rmcios *context)
+{
+   this->communication_channel = 0;
+   this->wait_channel = channel_enum (context, "wait");
+   this->address = 1;
+   this->function = 3;
+   this->type = modbus_u16;
+   modbus_rtu_set_baudrate (this, 9600);
+   this->timeout = 1.0;
+   this->rx_length = 0;
+   this->rx_time = 0;
+   this->tx_time = 0;
+#ifdef __linux__
+   pthread_mutex_init (&this->lock, NULL);
+#endif
+   this->crc_errors = 0;
+   this->timeouts = 0;
+   this->exceptions = 0;
+}
+
+// Wait the inter-frame silence before starting a new frame
+void modbus_rtu_wait_gap (struct modbus_rtu_data *this,
+                          const struct context_rmcios *context)
+{
+   double last = this->tx_time;
+   double remaining;
+   modbus_rtu_lock (this);
+   if (this->rx_time > last)
+      last = this->rx_time;
+   modbus_rtu_unlock (this);
+   remaining = last + this->frame_gap - monotonic_time ();
+   if (remaining > 0)
+      write_f (context, this->wait_channel, remaining);
+}
+
+// Send request from tx buffer (without CRC) and wait for the reply.
+// Returns pointer to the validated reply PDU or NULL on error.
+const unsigned char *modbus_rtu_transaction (struct modbus_rtu_data *this,
+                                             const struct context_rmcios
+                                             *context, int request_length,
+                                             int reply_length)
+{
+   unsigned short crc;
+   double start;
+   double poll_time;
+
+   if (this->communication_channel == 0)
+      return NULL;
+
+   crc = modbus_crc16 (this->tx, request_length);
+   this->tx[request_length++] = crc;
+   this->tx[request_length++] = crc >> 8;
+
+   modbus_rtu_wait_gap (this, context);
+   modbus_rtu_lock (this);
+   this->rx_length = 0;
+   modbus_rtu_unlock (this);
+   write_buffer (context, this->communication_channel, 
+                 (const char *) this->tx, request_length, 0);
+   start = this->tx_time = monotonic_time ();
+
+   // Poll for the reply with one frame gap resolution
+   poll_time = this->frame_gap;
+   if (poll_time < 0.001)
+      poll_time = 0.001;
+
+   while (1)
+   {
+      double now = monotonic_time ();
+      const unsigned char *rx = this->reply;
+      double rx_time;
+      int length;
+
+      // Copy received data so that late bytes do not change it
+      modbus_rtu_lock (this);
+      length = this->rx_length;
+      rx_time = this->rx_time;
+      memcpy (this->reply, this->rx, length);
+      modbus_rtu_unlock (this);
+
+      // Exception reply
+      if (length >= 5 && (rx[1] & 0x80))
+         length = 5;
+      // Complete reply or frame ended by silent interval
+      if (length >= reply_length
+          || (length > 0 && now - rx_time > this->frame_gap))
+      {
+         if (length < 5 || modbus_crc16 (rx, length) != 0)
+         {
+            this->crc_errors++;
+            info (context, context->errors, "modbus_rtu: CRC error\r\n");
+            return NULL;
+         }
+         if (rx[0] != this->tx[0])
+         {
+            info (context, context->errors,
+                  "modbus_rtu: Reply from wrong address\r\n");
+            return NULL;
+         }
+         if (rx[1] & 0x80)
+         {
+            char msg[48];
+            this->exceptions++;
+            sprintf (msg, "modbus_rtu: Exception %d\r\n", rx[2]);
+            info (context, context->errors, msg);
+            return NULL;
+         }
+         if (rx[1] != this->tx[1] || length != reply_length)
+         {
+            info (context, context->errors,
+                  "modbus_rtu: Invalid reply\r\n");
+            return NULL;
+         }
+         return rx + 1;
+      }
+      if (now - start > this->timeout)
+      {
+         this->timeouts++;
+         info (context, context->errors, "modbus_rtu: Timeout\r\n");
+         return NULL;
+      }
+      write_f (context, this->wait_channel, poll_time);
+   }
+}
+
+// Read block of registers using function 3 or 4. 
+// Returns pointer to register data inside the reception buffer.
+const unsigned char *modbus_rtu_read_registers (struct modbus_rtu_data *this,
+                                                const struct context_rmcios
+                                                *context, int address,
+                                                int function, int start,
+                                                int count)
+{
+   const unsigned char *reply;
+   if (count < 1 || count > MODBUS_MAX_READ_REGISTERS)
+      return NULL;
+   this->tx[0] = address;
+   this->tx[1] = function;
+   this->tx[2] = start >> 8;
+   this->tx[3] = start;
+   this->tx[4] = count >> 8;
+   this->tx[5] = count;
+   // address function bytecount data crc
+   reply = modbus_rtu_transaction (this, context, 6, 5 + 2 * count);
+   if (reply == NULL || reply[1] != 2 * count)
+      return NULL;
+   return reply + 2;
+}
+
+// Write registers from encoded big-endian data.
+// Uses function 6 for single register and function 16 for more.
+int modbus_rtu_write_registers (struct modbus_rtu_data *this,
+                                const struct context_rmcios *context,
+                                int address, int start, int count,
+                                const unsigned char *data)
+{
+   if (count < 1 || count > MODBUS_MAX_WRITE_REGISTERS)
+      return -1;
+   this->tx[0] = address;
+   this->tx[2] = start >> 8;
+   this->tx[3] = start;
+   if (count == 1)
+   {
+      this->tx[1] = 6;
+      this->tx[4] = data[0];
+      this->tx[5] = data[1];
+      // Reply echoes the request
+      if (modbus_rtu_transaction (this, context, 6, 8) == NULL)
+         return -1;
+   }
+   else
+   {
+      this->tx[1] = 16;
+      this->tx[4] = count >> 8;
+      this->tx[5] = count;
+      this->tx[6] = 2 * count;
+      memcpy (this->tx + 7, data, 2 * count);
+      // address function start count crc
+      if (modbus_rtu_transaction (this, context, 7 + 2 * count, 8) == NULL)
+         return -1;
+   }
+   return 0;
+}
+
+// Reception from the communication channel
+void modbus_rtu_rx_subchan_func (struct modbus_rtu_data *this,
+                                 const struct context_rmcios *context, int id,
+                                 enum function_rmcios function,
+                                 enum type_rmcios paramtype,
+                                 struct combo_rmcios *returnv,
+                                 int num_params,
+                                 const union param_rmcios param)
+{
+   switch (function)
+   {
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         int plen = param_buffer_alloc_size (context, paramtype, param, 0);
+         {
+            char buffer[plen];
+            struct buffer_rmcios b;
+            double now = monotonic_time ();
+            int length;
+            int i;
+
+            b = param_to_buffer (context, paramtype, param, 0, plen, buffer);
+            modbus_rtu_lock (this);
+            length = this->rx_length;
+            // Silent interval before the data starts a new frame
+            if (length > 0 && now - this->rx_time > this->frame_gap)
+               length = 0;
+            for (i = 0; i < b.length && length < MODBUS_RTU_MAX_ADU; i++)
+               this->rx[length++] = b.data[i];
+            this->rx_time = now;
+            this->rx_length = length;
+            modbus_rtu_unlock (this);
+         }
+      }
+      break;
+   default:
+      break;
+   }
+}
+
+void modbus_rtu_class_func (struct modbus_rtu_data *this,
                             const struct context_rmcios *context, int id,
                             enum function_rmcios function,
                             enum type_rmcios paramtype,
@@ -607,23 +1395,2028 @@ void modbus_rtu_class_func (struct conc_data *this,
                      "Channel for communicating with Modbus RTU -devices \r\n"
                      "create modbus_rtu newname\r\n"
                      "setup newname communication_channel | "
-                     " address | function\r\n"
-                     "write newname data | function | address\r\n"
-                     "read newname | function | address\r\n"
-                     "link newname linked_channel\r\n");
+                     " address | baudrate | timeout(s) | type"
+                     " | wait_channel\r\n"
+                     "  -type: u16 s16 u32 s32 f32 u32sw s32sw f32sw\r\n"
+                     "   (sw = low word first)\r\n"
+                     "write newname register value... \r\n"
+                     "  -write values using function 6 (single register)"
+                     " or 16 (multiple registers)\r\n"
+                     "  -more than 123 registers are written in several"
+                     " requests\r\n"
+                     "read newname register | count | type | function(3/4)"
+                     " | address\r\n"
+                     "  -read values using function 3 or 4\r\n"
+                     "link newname linked_channel\r\n"
+                     "  -read values are also sent to linked channels\r\n");
       break;
-   }
-}
 
-void init_std_device_channels (const struct context_rmcios *context)
-{
-   // Device channels
-   create_channel_str (context, "tsi4000",
-                       (class_rmcios) tsi_flow_class_func, NULL);
-   create_channel_str (context, "atm_hv", (class_rmcios) atm_hv_class_func,
-                       NULL);
-   create_channel_str (context, "pt",
-                       (class_rmcios) pt_temperature_class_func, NULL);
-   create_channel_str (context, "conc", (class_rmcios) conc_class_func, NULL);
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      this = (struct modbus_rtu_data *)
+             allocate_storage (context, sizeof (struct modbus_rtu_data), 0);
+      if (this == NULL)
+      {
+         info (context, context->errors, "Could not create modbus_rtu!\r\n");
+         break;
+      }
+
+      // default values:
+      modbus_rtu_init (this, context);
+
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) modbus_rtu_class_func,
+                                       this);
+      this->rx_channel =
+         create_subchannel_str (context, this->id, "_rx",
+                                (class_rmcios) modbus_rtu_rx_subchan_func,
+                                this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      this->communication_channel =
+         param_to_int (context, paramtype, param, 0);
+      // Receive replies through the _rx subchannel
+      link_channel (context, this->communication_channel, this->rx_channel);
+      if (num_params < 2)
+         break;
+      this->address = param_to_int (context, paramtype, param, 1);
+      if (num_params < 3)
+         break;
+      modbus_rtu_set_baudrate (this,
+                               param_to_float (context, paramtype, param, 2));
+      if (num_params < 4)
+         break;
+      this->timeout = param_to_float (context, paramtype, param, 3);
+      if (num_params < 5)
+         break;
+      {
+         char type[8];
+         param_to_string (context, paramtype, param, 4, sizeof (type), type);
+         this->type = modbus_type_from_string (type);
+      }
+      if (num_params < 6)
+         break;
+      this->wait_channel = param_to_int (context, paramtype, param, 5);
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      {
+         // Values past one request are written in further requests
+         unsigned char data[2 * MODBUS_MAX_WRITE_REGISTERS];
+         int registers = modbus_type_registers (this->type);
+         int start = param_to_int (context, paramtype, param, 0);
+         int count = 0;
+         int i;
+         for (i = 1; i < num_params; i++)
+         {
+            count += modbus_encode_value (data + 2 * count,
+                                          param_to_float (context, paramtype,
+                                                          param, i),
+                                          this->type) / 2;
+            if (i == num_params - 1
+                || count + registers > MODBUS_MAX_WRITE_REGISTERS)
+            {
+               if (modbus_rtu_write_registers (this, context, this->address,
+                                               start, count, data) != 0)
+               {
+                  if (i < num_params - 1)
+                     info (context, context->errors,
+                           "modbus_rtu: Write stopped."
+                           " Remaining values not written\r\n");
+                  break;
+               }
+               start += count;
+               count = 0;
+            }
+         }
+      }
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         const unsigned char *data;
+         enum modbus_value_type type = this->type;
+         int function = this->function;
+         int address = this->address;
+         int count = 1;
+         int registers;
+         int i;
+
+         if (num_params > 1)
+            count = param_to_int (context, paramtype, param, 1);
+         if (num_params > 2)
+         {
+            char typestr[8];
+            param_to_string (context, paramtype, param, 2,
+                             sizeof (typestr), typestr);
+            type = modbus_type_from_string (typestr);
+         }
+         if (num_params > 3)
+            function = param_to_int (context, paramtype, param, 3);
+         if (num_params > 4)
+            address = param_to_int (context, paramtype, param, 4);
+         if (function != 3 && function != 4)
+            break;
+
+         registers = modbus_type_registers (type);
+         data = modbus_rtu_read_registers (this, context, address, function,
+                                           param_to_int (context, paramtype,
+                                                         param, 0),
+                                           count * registers);
+         if (data == NULL)
+            break;
+
+         {
+            float values[MODBUS_MAX_READ_REGISTERS];
+            for (i = 0; i < count; i++)
+            {
+               values[i] =
+                  modbus_register_value (data + 2 * registers * i, type);
+               return_float (context, returnv, values[i]);
+            }
+            write_fv (context, linked_channels (context, id), count, values);
+         }
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+///////////////////////////////////////////////////////////
+// Modbus register cache with coalesced block reads
+///////////////////////////////////////////////////////////
+struct modbus_poll_register
+{
+   unsigned char address;
+   unsigned char function;
+   unsigned short reg;
+   enum modbus_value_type type;
+   float interval;      // s, refresh interval
+   float max_age;       // s, oldest value served from cache
+   float value;
+   double updated;
+   double next_due;
+};
+
+struct modbus_poll_block
+{
+   unsigned char address;
+   unsigned char function;
+   unsigned short start;
+   unsigned short count;
+   int first;           // first register index in the sorted order
+   int num_registers;
+};
+
+struct modbus_poll_data
+{
+   int id;
+   struct modbus_rtu_data master;
+
+   // Registers in the order they were added
+   struct modbus_poll_register *registers;
+   int num_registers;
+   int registers_size;
+
+   // Register indexes sorted by address, function and register 
+   int *sorted;
+   struct modbus_poll_block *blocks;
+   int num_blocks;
+   int max_gap;
+
+   // Throughput statistics
+   double busy_time;
+   double registers_read;
+   int transactions;
+   int failures;
+};
+
+int modbus_poll_compare (const struct modbus_poll_register *ra,
+                         const struct modbus_poll_register *rb)
+{
+   if (ra->address != rb->address)
+      return ra->address - rb->address;
+   if (ra->function != rb->function)
+      return ra->function - rb->function;
+   return ra->reg - rb->reg;
+}
+
+// Group registers to the fewest block reads fitting in one PDU
+void modbus_poll_plan (struct modbus_poll_data *this)
+{
+   int i;
+   struct modbus_poll_block *block = NULL;
+
+   // Insertion sort. Registers are added one at a time, so the order
+   // is mostly sorted already.
+   for (i = 0; i < this->num_registers; i++)
+   {
+      int j = i;
+      while (j > 0
+             && modbus_poll_compare (this->registers + this->sorted[j - 1],
+                                     this->registers + i) > 0)
+      {
+         this->sorted[j] = this->sorted[j - 1];
+         j--;
+      }
+      this->sorted[j] = i;
+   }
+
+   this->num_blocks = 0;
+   for (i = 0; i < this->num_registers; i++)
+   {
+      struct modbus_poll_register *r = this->registers + this->sorted[i];
+      int end = r->reg + modbus_type_registers (r->type);
+
+      if (block != NULL 
+          && block->address == r->address 
+          && block->function == r->function
+          && r->reg <= block->start + block->count + this->max_gap
+          && end - block->start <= MODBUS_MAX_READ_REGISTERS)
+      {
+         // Extend the current block
+         if (end - block->start > block->count)
+            block->count = end - block->start;
+         block->num_registers++;
+      }
+      else
+      {
+         // Start new block
+         block = this->blocks + this->num_blocks++;
+         block->address = r->address;
+         block->function = r->function;
+         block->start = r->reg;
+         block->count = end - r->reg;
+         block->first = i;
+         block->num_registers = 1;
+      }
+   }
+}
+
+// Read the block and update all registers in it. Returns 0 on success.
+int modbus_poll_refresh (struct modbus_poll_data *this,
+                         const struct context_rmcios *context,
+                         struct modbus_poll_block *block)
+{
+   const unsigned char *data;
+   double start = monotonic_time ();
+   double now;
+   int i;
+
+   data = modbus_rtu_read_registers (&this->master, context, block->address,
+                                     block->function, block->start,
+                                     block->count);
+   now = monotonic_time ();
+   this->busy_time += now - start;
+   this->transactions++;
+   if (data == NULL)
+   {
+      // Try again on the next interval instead of every poll
+      this->failures++;
+      for (i = block->first; i < block->first + block->num_registers; i++)
+      {
+         struct modbus_poll_register *r = this->registers + this->sorted[i];
+         r->next_due = now + r->interval;
+      }
+      return -1;
+   }
+
+   for (i = block->first; i < block->first + block->num_registers; i++)
+   {
+      struct modbus_poll_register *r = this->registers + this->sorted[i];
+      r->value = modbus_register_value (data + 2 * (r->reg - block->start),
+                                        r->type);
+      r->updated = now;
+      r->next_due = now + r->interval;
+   }
+   this->registers_read += block->num_registers;
+   return 0;
+}
+
+struct modbus_poll_block *modbus_poll_find (struct modbus_poll_data *this,
+                                            int address, int function,
+                                            int reg, 
+                                            struct modbus_poll_register **r)
+{
+   int i;
+   for (i = 0; i < this->num_blocks; i++)
+   {
+      struct modbus_poll_block *block = this->blocks + i;
+      int j;
+      if (block->address != address || block->function != function)
+         continue;
+      if (reg < block->start || reg >= block->start + block->count)
+         continue;
+      for (j = block->first; j < block->first + block->num_registers; j++)
+      {
+         if (this->registers[this->sorted[j]].reg == reg)
+         {
+            *r = this->registers + this->sorted[j];
+            return block;
+         }
+      }
+   }
+   return NULL;
+}
+
+void modbus_poll_reg_subchan_func (struct modbus_poll_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   switch (function)
+   {
+   case setup_rmcios:
+      // Remove all registers
+      if (this == NULL)
+         break;
+      this->num_registers = 0;
+      this->num_blocks = 0;
+      break;
+
+   case write_rmcios:
+      // Add register to the poll plan
+      if (this == NULL)
+         break;
+      if (num_params < 3)
+         break;
+      if (this->num_registers == this->registers_size)
+      {
+         int size = this->registers_size ? this->registers_size * 2 : 16;
+         void *registers = realloc (this->registers,
+                                    size * sizeof (*this->registers));
+         void *sorted = realloc (this->sorted, size * sizeof (int));
+         void *blocks = realloc (this->blocks, size * sizeof (*this->blocks));
+         if (registers != NULL)
+            this->registers = registers;
+         if (sorted != NULL)
+            this->sorted = sorted;
+         if (blocks != NULL)
+            this->blocks = blocks;
+         if (registers == NULL || sorted == NULL || blocks == NULL)
+         {
+            info (context, context->errors,
+                  "modbus_poll: Could not allocate register!\r\n");
+            break;
+         }
+         this->registers_size = size;
+      }
+      {
+         struct modbus_poll_register *r = this->registers 
+                                          + this->num_registers++;
+         r->address = param_to_int (context, paramtype, param, 0);
+         r->function = param_to_int (context, paramtype, param, 1);
+         r->reg = param_to_int (context, paramtype, param, 2);
+         r->type = modbus_u16;
+         r->interval = 1;
+         if (r->function != 4)
+            r->function = 3;
+         if (num_params > 3)
+         {
+            char type[8];
+            param_to_string (context, paramtype, param, 3,
+                             sizeof (type), type);
+            r->type = modbus_type_from_string (type);
+         }
+         if (num_params > 4)
+            r->interval = param_to_float (context, paramtype, param, 4);
+         r->max_age = r->interval;
+         if (num_params > 5)
+            r->max_age = param_to_float (context, paramtype, param, 5);
+         r->value = NAN;
+         r->updated = 0;
+         r->next_due = 0;
+      }
+      modbus_poll_plan (this);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_int (context, returnv, this->num_registers);
+      break;
+
+   default:
+      break;
+   }
+}
+
+void modbus_poll_stats_subchan_func (struct modbus_poll_data *this,
+                                     const struct context_rmcios *context,
+                                     int id, enum function_rmcios function,
+                                     enum type_rmcios paramtype,
+                                     struct combo_rmcios *returnv,
+                                     int num_params,
+                                     const union param_rmcios param)
+{
+   switch (function)
+   {
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      this->busy_time = 0;
+      this->registers_read = 0;
+      this->transactions = 0;
+      this->failures = 0;
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      // registers/s while the line is busy
+      return_float (context, returnv,
+                    this->busy_time > 0 ? 
+                    this->registers_read / this->busy_time : 0);
+      return_int (context, returnv, this->num_blocks);
+      return_int (context, returnv, this->transactions);
+      return_int (context, returnv, this->failures);
+      break;
+
+   default:
+      break;
+   }
+}
+
+void modbus_poll_class_func (struct modbus_poll_data *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "Modbus RTU register cache with coalesced block reads\r\n"
+                     "create modbus_poll newname\r\n"
+                     "setup newname communication_channel | baudrate"
+                     " | timeout(s) | max_gap | wait_channel\r\n"
+                     "  -max_gap: unused registers allowed inside"
+                     " one block read (default 0). Slaves may reject"
+                     " reads of unmapped registers\r\n"
+                     "write newname_reg address function(3/4) register"
+                     " | type | interval(s) | max_age(s)\r\n"
+                     "  -add register to the poll plan\r\n"
+                     "  -registers are grouped to fewest block reads\r\n"
+                     "  -a block is refreshed at the rate of its fastest"
+                     " register\r\n"
+                     "setup newname_reg #remove all registers\r\n"
+                     "write newname\r\n"
+                     "  -refresh blocks that have registers due\r\n"
+                     "  -send all values to linked channels in the order"
+                     " they were added\r\n"
+                     "read newname address register | function\r\n"
+                     "  -read value from cache. Value older than max_age"
+                     " is refreshed first\r\n"
+                     "read newname_stats\r\n"
+                     "  -registers/s blocks transactions failures\r\n"
+                     "setup newname_stats #reset statistics\r\n"
+                     "link newname channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      this = (struct modbus_poll_data *)
+             allocate_storage (context, sizeof (struct modbus_poll_data), 0);
+      if (this == NULL)
+      {
+         info (context, context->errors, "Could not create modbus_poll!\r\n");
+         break;
+      }
+
+      // default values:
+      modbus_rtu_init (&this->master, context);
+
+      this->registers = NULL;
+      this->sorted = NULL;
+      this->blocks = NULL;
+      this->num_registers = 0;
+      this->registers_size = 0;
+      this->num_blocks = 0;
+      this->max_gap = 0;
+      this->busy_time = 0;
+      this->registers_read = 0;
+      this->transactions = 0;
+      this->failures = 0;
+
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) modbus_poll_class_func,
+                                       this);
+      this->master.id = this->id;
+      this->master.rx_channel =
+         create_subchannel_str (context, this->id, "_rx",
+                                (class_rmcios) modbus_rtu_rx_subchan_func,
+                                &this->master);
+      create_subchannel_str (context, this->id, "_reg",
+                             (class_rmcios) modbus_poll_reg_subchan_func,
+                             this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) modbus_poll_stats_subchan_func,
+                             this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      this->master.communication_channel =
+         param_to_int (context, paramtype, param, 0);
+      link_channel (context, this->master.communication_channel,
+                    this->master.rx_channel);
+      if (num_params < 2)
+         break;
+      modbus_rtu_set_baudrate (&this->master,
+                               param_to_float (context, paramtype, param, 1));
+      if (num_params < 3)
+         break;
+      this->master.timeout = param_to_float (context, paramtype, param, 2);
+      if (num_params < 4)
+         break;
+      this->max_gap = param_to_int (context, paramtype, param, 3);
+      if (this->max_gap < 0)
+         this->max_gap = 0;
+      modbus_poll_plan (this);
+      if (num_params < 5)
+         break;
+      this->master.wait_channel = param_to_int (context, paramtype, param, 4);
+      break;
+
+   case write_rmcios:
+      // Poll due registers
+      if (this == NULL)
+         break;
+      {
+         double now = monotonic_time ();
+         int i;
+         for (i = 0; i < this->num_blocks; i++)
+         {
+            struct modbus_poll_block *block = this->blocks + i;
+            int j;
+            for (j = block->first; j < block->first + block->num_registers;
+                 j++)
+            {
+               if (now >= this->registers[this->sorted[j]].next_due)
+               {
+                  modbus_poll_refresh (this, context, block);
+                  break;
+               }
+            }
+         }
+         if (this->num_registers > 0)
+         {
+            float values[this->num_registers];
+            for (i = 0; i < this->num_registers; i++)
+               values[i] = this->registers[i].value;
+            write_fv (context, linked_channels (context, id),
+                      this->num_registers, values);
+         }
+      }
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      {
+         struct modbus_poll_register *r = NULL;
+         struct modbus_poll_block *block;
+         int function = 3;
+         if (num_params > 2)
+            function = param_to_int (context, paramtype, param, 2);
+         block = modbus_poll_find (this,
+                                   param_to_int (context, paramtype, param, 0),
+                                   function,
+                                   param_to_int (context, paramtype, param, 1),
+                                   &r);
+         if (block == NULL)
+         {
+            return_float (context, returnv, NAN);
+            break;
+         }
+         if (monotonic_time () - r->updated > r->max_age)
+            modbus_poll_refresh (this, context, block);
+         return_float (context, returnv, r->value);
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+///////////////////////////////////////////////////////////
+// Modbus RTU slave simulator
+///////////////////////////////////////////////////////////
+#define MODBUS_SIM_MAX_SLAVES 16
+
+struct modbus_sim_slave
+{
+   unsigned char address;
+   unsigned short *holding;     // function 3, 6 and 16
+   int num_holding;
+   unsigned short *input;       // function 4
+   int num_input;
+};
+
+struct modbus_sim_data
+{
+   int id;
+   struct modbus_sim_slave slaves[MODBUS_SIM_MAX_SLAVES];
+   int num_slaves;
+
+   float latency;       // s, delay before reply
+   float error_rate;    // probability of injected error per request
+   float frame_gap;     // s, silent interval that ends a request
+   int wait_channel;
+   unsigned int random;
+
+   // Request reception
+   unsigned char rx[MODBUS_RTU_MAX_ADU];
+   int rx_length;
+   double rx_time;
+   int rx_discard;      // Drop bytes until silent interval
+
+   int requests;
+   int errors_injected;
+
+#ifdef __linux__
+   // Pseudo-terminal 
+   int pty_fd;
+   char pty_name[64];
+   pthread_t thread;
+   volatile int running;
+
+   // Register maps are shared with the pseudo-terminal thread
+   pthread_mutex_t lock;
+#endif
+};
+
+void modbus_sim_lock (struct modbus_sim_data *this)
+{
+#ifdef __linux__
+   pthread_mutex_lock (&this->lock);
+#endif
+}
+
+void modbus_sim_unlock (struct modbus_sim_data *this)
+{
+#ifdef __linux__
+   pthread_mutex_unlock (&this->lock);
+#endif
+}
+
+struct modbus_sim_slave *modbus_sim_slave (struct modbus_sim_data *this,
+                                           int address, int create)
+{
+   int i;
+   for (i = 0; i < this->num_slaves; i++)
+   {
+      if (this->slaves[i].address == address)
+         return this->slaves + i;
+   }
+   if (!create || this->num_slaves == MODBUS_SIM_MAX_SLAVES)
+      return NULL;
+   this->slaves[i].address = address;
+   this->slaves[i].holding = NULL;
+   this->slaves[i].num_holding = 0;
+   this->slaves[i].input = NULL;
+   this->slaves[i].num_input = 0;
+   this->num_slaves++;
+   return this->slaves + i;
+}
+
+// Exception code for request that is invalid already by its header.
+// 0 for valid or not yet known.
+int modbus_sim_request_invalid (const unsigned char *rx, int length)
+{
+   if (length < 2)
+      return 0;
+   switch (rx[1])
+   {
+   case 3:
+   case 4:
+   case 6:
+      return 0;
+   case 16:
+      if (length < 7)
+         return 0;
+      // Byte count must match quantity and fit in the frame
+      if (rx[6] > 2 * MODBUS_MAX_WRITE_REGISTERS
+          || rx[6] != 2 * (rx[4] << 8 | rx[5]))
+         return 3;
+      return 0;
+   default:
+      // Illegal function
+      return 1;
+   }
+}
+
+// Length of complete request frame. 0 when not yet known.
+// Invalid requests are complete as soon as their header is in.
+int modbus_sim_request_length (const unsigned char *rx, int length)
+{
+   if (length < 2)
+      return 0;
+   switch (rx[1])
+   {
+   case 3:
+   case 4:
+   case 6:
+      return 8;
+   case 16:
+      if (length < 7)
+         return 0;
+      if (modbus_sim_request_invalid (rx, length))
+         return 7;
+      return 9 + rx[6];
+   default:
+      return 2;
+   }
+}
+
+int modbus_sim_exception (unsigned char *reply, int code)
+{
+   reply[1] |= 0x80;
+   reply[2] = code;
+   return 3;
+}
+
+// Build reply for request. Returns reply length with CRC, 0 for no reply.
+int modbus_sim_reply (struct modbus_sim_data *this,
+                      const unsigned char *request, int length,
+                      unsigned char *reply)
+{
+   struct modbus_sim_slave *slave;
+   unsigned short *registers;
+   int num_registers;
+   int start, count;
+   int reply_length;
+   int error = 0;
+   int invalid;
+   unsigned short crc;
+   int i;
+
+   // Shortest request is address, function, start, count and CRC.
+   // Invalid requests are answered by their header only.
+   invalid = modbus_sim_request_invalid (request, length);
+   if (invalid == 0 && (length < 8 || modbus_crc16 (request, length) != 0))
+      return 0;
+   slave = modbus_sim_slave (this, request[0], 0);
+   if (slave == NULL)
+      return 0;
+   this->requests++;
+
+   // xorshift32
+   this->random ^= this->random << 13;
+   this->random ^= this->random >> 17;
+   this->random ^= this->random << 5;
+   if (this->error_rate > 0 
+       && (this->random & 0xFFFFFF) < this->error_rate * 0x1000000)
+   {
+      this->errors_injected++;
+      error = 1 + (this->random >> 24) % 4;
+      // No reply at all
+      if (error == 1)
+         return 0;
+   }
+
+   reply[0] = request[0];
+   reply[1] = request[1];
+   start = request[2] << 8 | request[3];
+   count = request[4] << 8 | request[5];
+   if (request[1] == 4)
+   {
+      registers = slave->input;
+      num_registers = slave->num_input;
+   }
+   else
+   {
+      registers = slave->holding;
+      num_registers = slave->num_holding;
+   }
+
+   if (invalid != 0)
+      reply_length = modbus_sim_exception (reply, invalid);
+   else switch (request[1])
+   {
+   case 3:
+   case 4:
+      if (count < 1 || count > MODBUS_MAX_READ_REGISTERS)
+      {
+         reply_length = modbus_sim_exception (reply, 3);
+         break;
+      }
+      if (start + count > num_registers)
+      {
+         reply_length = modbus_sim_exception (reply, 2);
+         break;
+      }
+      reply[2] = 2 * count;
+      for (i = 0; i < count; i++)
+      {
+         reply[3 + 2 * i] = registers[start + i] >> 8;
+         reply[4 + 2 * i] = registers[start + i];
+      }
+      reply_length = 3 + 2 * count;
+      break;
+
+   case 6:
+      if (start >= num_registers)
+      {
+         reply_length = modbus_sim_exception (reply, 2);
+         break;
+      }
+      registers[start] = count;
+      memcpy (reply, request, 6);
+      reply_length = 6;
+      break;
+
+   case 16:
+      if (count < 1 || count > MODBUS_MAX_WRITE_REGISTERS)
+      {
+         reply_length = modbus_sim_exception (reply, 3);
+         break;
+      }
+      if (start + count > num_registers)
+      {
+         reply_length = modbus_sim_exception (reply, 2);
+         break;
+      }
+      for (i = 0; i < count; i++)
+         registers[start + i] = request[7 + 2 * i] << 8 | request[8 + 2 * i];
+      memcpy (reply, request, 6);
+      reply_length = 6;
+      break;
+
+   default:
+      break;
+   }
+
+   // Slave device failure
+   if (error == 2)
+   {
+      reply[1] = request[1];
+      reply_length = modbus_sim_exception (reply, 4);
+   }
+
+   crc = modbus_crc16 (reply, reply_length);
+   reply[reply_length++] = crc;
+   reply[reply_length++] = crc >> 8;
+
+   // Corrupted CRC
+   if (error == 3)
+      reply[reply_length - 1] ^= 0x5A;
+   // Truncated frame
+   if (error == 4 && reply_length > 4)
+      reply_length -= 2;
+   return reply_length;
+}
+
+#ifdef __linux__
+void *modbus_sim_thread (void *data)
+{
+   struct modbus_sim_data *this = data;
+   unsigned char request[MODBUS_RTU_MAX_ADU];
+   unsigned char reply[MODBUS_RTU_MAX_ADU];
+   int length = 0;
+   int discard = 0;
+   int gap_ms;
+   float latency;
+
+   modbus_sim_lock (this);
+   gap_ms = this->frame_gap * 1000 + 1;
+   modbus_sim_unlock (this);
+
+   while (this->running)
+   {
+      struct pollfd pfd = {.fd = this->pty_fd,.events = POLLIN };
+      int expected = modbus_sim_request_length (request, length);
+      int ready = poll (&pfd, 1, length > 0 || discard ? gap_ms : 100);
+
+      if (ready > 0 && (pfd.revents & POLLIN))
+      {
+         int n = read (this->pty_fd, request + length,
+                       MODBUS_RTU_MAX_ADU - length);
+         if (n > 0)
+            length += n;
+         if (discard)
+         {
+            // Rest of an answered frame
+            length = 0;
+            continue;
+         }
+         expected = modbus_sim_request_length (request, length);
+         if (expected == 0 || length < expected)
+         {
+            if (length == MODBUS_RTU_MAX_ADU)
+            {
+               // Overlong frame
+               discard = 1;
+               length = 0;
+            }
+            continue;
+         }
+      }
+      else if (ready < 0 || (pfd.revents & (POLLERR | POLLNVAL)))
+      {
+         break;
+      }
+      else if (length == 0)
+      {
+         discard = 0;
+         continue;
+      }
+
+      // Complete frame or silent interval
+      {
+         int reply_length;
+         modbus_sim_lock (this);
+         reply_length = modbus_sim_reply (this, request, length, reply);
+         latency = this->latency;
+         modbus_sim_unlock (this);
+         // Bytes after an invalid header belong to the same frame
+         discard = modbus_sim_request_invalid (request, length) != 0;
+         if (reply_length > 0)
+         {
+            if (latency > 0)
+            {
+               struct timespec ts;
+               ts.tv_sec = latency;
+               ts.tv_nsec = (latency - ts.tv_sec) * 1e9;
+               nanosleep (&ts, NULL);
+            }
+            if (write (this->pty_fd, reply, reply_length) < 0)
+               break;
+         }
+      }
+      length = 0;
+   }
+   return NULL;
+}
+
+int modbus_sim_open_pty (struct modbus_sim_data *this)
+{
+   struct termios tio;
+   int fd = posix_openpt (O_RDWR | O_NOCTTY);
+   if (fd < 0)
+      return -1;
+   if (grantpt (fd) != 0 || unlockpt (fd) != 0
+       || ptsname_r (fd, this->pty_name, sizeof (this->pty_name)) != 0)
+   {
+      close (fd);
+      return -1;
+   }
+   // Raw binary transfer
+   if (tcgetattr (fd, &tio) == 0)
+   {
+      cfmakeraw (&tio);
+      tcsetattr (fd, TCSANOW, &tio);
+   }
+   this->pty_fd = fd;
+   this->running = 1;
+   if (pthread_create (&this->thread, NULL, modbus_sim_thread, this) != 0)
+   {
+      this->running = 0;
+      close (fd);
+      this->pty_fd = -1;
+      return -1;
+   }
+   return 0;
+}
+
+void modbus_sim_close_pty (struct modbus_sim_data *this)
+{
+   if (this->pty_fd < 0)
+      return;
+   this->running = 0;
+   pthread_join (this->thread, NULL);
+   close (this->pty_fd);
+   this->pty_fd = -1;
+   this->pty_name[0] = 0;
+}
+#endif
+
+void modbus_sim_reg_subchan_func (struct modbus_sim_data *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
+{
+   struct modbus_sim_slave *slave;
+   unsigned short **registers;
+   int *num_registers;
+   int start;
+   int i;
+
+   if (this == NULL || num_params < 3)
+      return;
+   modbus_sim_lock (this);
+   slave = modbus_sim_slave (this, param_to_int (context, paramtype, param, 0),
+                             function == write_rmcios);
+   if (slave == NULL)
+   {
+      modbus_sim_unlock (this);
+      return;
+   }
+   if (param_to_int (context, paramtype, param, 1) == 4)
+   {
+      registers = &slave->input;
+      num_registers = &slave->num_input;
+   }
+   else
+   {
+      registers = &slave->holding;
+      num_registers = &slave->num_holding;
+   }
+   start = param_to_int (context, paramtype, param, 2);
+
+   switch (function)
+   {
+   case write_rmcios:
+      // Set register values. Register map grows as needed.
+      if (start < 0 || start + num_params - 3 > 0x10000)
+         break;
+      if (start + num_params - 3 > *num_registers)
+      {
+         int size = start + num_params - 3;
+         unsigned short *r = realloc (*registers, size * sizeof (**registers));
+         if (r == NULL)
+         {
+            info (context, context->errors,
+                  "modbus_sim: Could not allocate registers!\r\n");
+            break;
+         }
+         memset (r + *num_registers, 0,
+                 (size - *num_registers) * sizeof (*r));
+         *registers = r;
+         *num_registers = size;
+      }
+      for (i = 3; i < num_params; i++)
+      {
+         (*registers)[start + i - 3] =
+            param_to_int (context, paramtype, param, i);
+      }
+      break;
+
+   case read_rmcios:
+      if (start >= 0 && start < *num_registers)
+         return_int (context, returnv, (*registers)[start]);
+      break;
+
+   default:
+      break;
+   }
+   modbus_sim_unlock (this);
+}
+
+void modbus_sim_stats_subchan_func (struct modbus_sim_data *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   switch (function)
+   {
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      this->requests = 0;
+      this->errors_injected = 0;
+      break;
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_int (context, returnv, this->requests);
+      return_int (context, returnv, this->errors_injected);
+      break;
+   default:
+      break;
+   }
+}
+
+void modbus_sim_class_func (struct modbus_sim_data *this,
+                            const struct context_rmcios *context, int id,
+                            enum function_rmcios function,
+                            enum type_rmcios paramtype,
+                            struct combo_rmcios *returnv,
+                            int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "Modbus RTU slave simulator for testing without"
+                     " devices\r\n"
+                     "create modbus_sim newname\r\n"
+                     "setup newname latency(s) | error_rate(0..1)"
+                     " | frame_gap(s) | pty(0/1)\r\n"
+                     "  -error_rate: probability of injected error. "
+                     "Errors are missing reply, device failure exception, "
+                     "bad CRC or truncated frame.\r\n"
+                     "  -pty=1: serve slaves on pseudo-terminal (linux)\r\n"
+                     "write newname_reg address function(3/4) register"
+                     " value...\r\n"
+                     "  -set register values. Creates the slave.\r\n"
+                     "read newname_reg address function(3/4) register\r\n"
+                     "write newname data\r\n"
+                     "  -feed request bytes directly."
+                     " Reply is sent to linked channels\r\n"
+                     "read newname\r\n"
+                     "  -pseudo-terminal device name for the master\r\n"
+                     "read newname_stats\r\n"
+                     "  -requests errors_injected\r\n"
+                     "setup newname_stats #reset statistics\r\n"
+                     "link newname channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      this = (struct modbus_sim_data *)
+             allocate_storage (context, sizeof (struct modbus_sim_data), 0);
+      if (this == NULL)
+      {
+         info (context, context->errors, "Could not create modbus_sim!\r\n");
+         break;
+      }
+
+      // default values:
+      this->num_slaves = 0;
+      this->latency = 0;
+      this->error_rate = 0;
+      this->frame_gap = 0.002;
+      this->wait_channel = channel_enum (context, "wait");
+      this->random = 2463534242U;
+      this->rx_length = 0;
+      this->rx_time = 0;
+      this->rx_discard = 0;
+      this->requests = 0;
+      this->errors_injected = 0;
+#ifdef __linux__
+      this->pty_fd = -1;
+      this->pty_name[0] = 0;
+      this->running = 0;
+      pthread_mutex_init (&this->lock, NULL);
+#endif
+
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) modbus_sim_class_func,
+                                       this);
+      create_subchannel_str (context, this->id, "_reg",
+                             (class_rmcios) modbus_sim_reg_subchan_func, this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) modbus_sim_stats_subchan_func,
+                             this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      modbus_sim_lock (this);
+      this->latency = param_to_float (context, paramtype, param, 0);
+      if (num_params > 1)
+         this->error_rate = param_to_float (context, paramtype, param, 1);
+      if (num_params > 2)
+         this->frame_gap = param_to_float (context, paramtype, param, 2);
+      modbus_sim_unlock (this);
+      if (num_params < 4)
+         break;
+#ifdef __linux__
+      modbus_sim_close_pty (this);
+      if (param_to_int (context, paramtype, param, 3) != 0 
+          && modbus_sim_open_pty (this) != 0)
+      {
+         info (context, context->errors,
+               "modbus_sim: Could not open pseudo-terminal!\r\n");
+      }
+#else
+      info (context, context->errors,
+            "modbus_sim: pseudo-terminal is not supported\r\n");
+#endif
+      break;
+
+   case write_rmcios:
+      // Request bytes from a master
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         int plen = param_buffer_alloc_size (context, paramtype, param, 0);
+         char buffer[plen];
+         unsigned char reply[MODBUS_RTU_MAX_ADU];
+         struct buffer_rmcios b;
+         double now = monotonic_time ();
+         int expected;
+         int i;
+
+         b = param_to_buffer (context, paramtype, param, 0, plen, buffer);
+         if (now - this->rx_time > this->frame_gap)
+         {
+            this->rx_length = 0;
+            this->rx_discard = 0;
+         }
+         this->rx_time = now;
+         if (this->rx_discard)
+            break;
+         for (i = 0; i < b.length && this->rx_length < MODBUS_RTU_MAX_ADU; 
+              i++)
+            this->rx[this->rx_length++] = b.data[i];
+
+         expected = modbus_sim_request_length (this->rx, this->rx_length);
+         if (expected == 0 || this->rx_length < expected)
+         {
+            if (this->rx_length == MODBUS_RTU_MAX_ADU)
+            {
+               // Overlong frame
+               this->rx_length = 0;
+               this->rx_discard = 1;
+            }
+            break;
+         }
+         modbus_sim_lock (this);
+         i = modbus_sim_reply (this, this->rx, this->rx_length, reply);
+         modbus_sim_unlock (this);
+         // Bytes after an invalid header belong to the same frame
+         this->rx_discard =
+            modbus_sim_request_invalid (this->rx, this->rx_length) != 0;
+         this->rx_length = 0;
+         if (i > 0)
+         {
+            if (this->latency > 0)
+               write_f (context, this->wait_channel, this->latency);
+            write_buffer (context, linked_channels (context, this->id),
+                          (const char *) reply, i, 0);
+         }
+      }
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+#ifdef __linux__
+      return_string (context, returnv, this->pty_name);
+#endif
+      break;
+
+   default:
+      break;
+   }
+}
+
+///////////////////////////////////////////////////////////
+// Request/response transaction manager
+///////////////////////////////////////////////////////////
+#define TRANSACTION_MAX_TERMINATOR 8
+#define TRANSACTION_RX_SIZE 512
+
+struct transaction_manager;
+
+struct transaction
+{
+   struct transaction *next;
+   struct transaction_manager *manager;
+   int reply_channel;
+
+   // Response is complete after length bytes or the terminator
+   char terminator[TRANSACTION_MAX_TERMINATOR];
+   int terminator_length;
+   int length;
+
+   float timeout;
+   int retries;
+   int sent;
+   double deadline;
+   int heap_index;     // Position in timer heap. -1 when not armed.
+
+   int request_length;
+   char request[];
+};
+
+struct transaction_manager
+{
+   int id;
+   int rx_channel;
+   int transport;
+   int depth;          // Maximum transactions in flight (pipelining)
+   float timeout;
+   int retries;
+   char terminator[TRANSACTION_MAX_TERMINATOR];
+   int terminator_length;
+
+   // Queue of transactions. First inflight ones have been sent.
+   struct transaction *queue;
+   int queued;
+   int inflight;
+
+   char rx[TRANSACTION_RX_SIZE];
+   int rx_length;
+
+   // Statistics
+   unsigned int completed;
+   unsigned int timeouts;
+   unsigned int retransmits;
+};
+
+// Request to transport or response to reply channel. Written after the
+// lock has been released. Length -1 is an empty write.
+struct transaction_output
+{
+   struct transaction_output *next;
+   int channel;
+   int length;
+   char data[];
+};
+
+// All managers share one timer heap, output queue and lock.
+static struct transaction **transaction_heap = NULL;
+static int transaction_heap_size = 0;
+static int transaction_heap_capacity = 0;
+static struct transaction_output *transaction_outbox = NULL;
+static struct transaction_output **transaction_outbox_tail =
+   &transaction_outbox;
+static int transaction_flushing = 0;
+
+#ifdef __linux__
+static pthread_mutex_t transaction_mutex;
+static pthread_cond_t transaction_timer_changed;
+static pthread_t transaction_thread;
+static int transaction_initialized = 0;
+static const struct context_rmcios *transaction_context = NULL;
+#endif
+
+void transaction_lock (void)
+{
+#ifdef __linux__
+   pthread_mutex_lock (&transaction_mutex);
+#endif
+}
+
+void transaction_unlock (void)
+{
+#ifdef __linux__
+   pthread_mutex_unlock (&transaction_mutex);
+#endif
+}
+
+void transaction_heap_swap (int a, int b)
+{
+   struct transaction *t = transaction_heap[a];
+   transaction_heap[a] = transaction_heap[b];
+   transaction_heap[b] = t;
+   transaction_heap[a]->heap_index = a;
+   transaction_heap[b]->heap_index = b;
+}
+
+void transaction_heap_up (int i)
+{
+   while (i > 0
+          && transaction_heap[(i - 1) / 2]->deadline >
+          transaction_heap[i]->deadline)
+   {
+      transaction_heap_swap (i, (i - 1) / 2);
+      i = (i - 1) / 2;
+   }
+}
+
+void transaction_heap_down (int i)
+{
+   for (;;)
+   {
+      int smallest = i;
+      int left = 2 * i + 1;
+      int right = left + 1;
+      if (left < transaction_heap_size
+          && transaction_heap[left]->deadline <
+          transaction_heap[smallest]->deadline)
+         smallest = left;
+      if (right < transaction_heap_size
+          && transaction_heap[right]->deadline <
+          transaction_heap[smallest]->deadline)
+         smallest = right;
+      if (smallest == i)
+         break;
+      transaction_heap_swap (i, smallest);
+      i = smallest;
+   }
+}
+
+int transaction_heap_push (struct transaction *t)
+{
+   if (transaction_heap_size == transaction_heap_capacity)
+   {
+      int capacity = transaction_heap_capacity ?
+         transaction_heap_capacity * 2 : 16;
+      struct transaction **heap =
+         realloc (transaction_heap, capacity * sizeof (*heap));
+      if (heap == NULL)
+         return -1;
+      transaction_heap = heap;
+      transaction_heap_capacity = capacity;
+   }
+   t->heap_index = transaction_heap_size++;
+   transaction_heap[t->heap_index] = t;
+   transaction_heap_up (t->heap_index);
+#ifdef __linux__
+   pthread_cond_signal (&transaction_timer_changed);
+#endif
+   return 0;
+}
+
+void transaction_heap_remove (struct transaction *t)
+{
+   int i = t->heap_index;
+   if (i < 0)
+      return;
+   t->heap_index = -1;
+   transaction_heap_size--;
+   if (i == transaction_heap_size)
+      return;
+   transaction_heap[i] = transaction_heap[transaction_heap_size];
+   transaction_heap[i]->heap_index = i;
+   transaction_heap_up (i);
+   transaction_heap_down (transaction_heap[i]->heap_index);
+}
+
+// Queue write for transaction_flush. Called with the lock held.
+void transaction_output (int channel, const char *data, int length)
+{
+   struct transaction_output *o;
+   o = malloc (sizeof (*o) + (length > 0 ? length : 0));
+   if (o == NULL)
+      return;
+   o->next = NULL;
+   o->channel = channel;
+   o->length = length;
+   if (length > 0)
+      memcpy (o->data, data, length);
+   *transaction_outbox_tail = o;
+   transaction_outbox_tail = &o->next;
+}
+
+// Write queued requests and responses in order. Called without the lock,
+// so that transports and reply channels can take their own locks and
+// submit new transactions. Only one thread writes at a time, others
+// leave their output to it.
+void transaction_flush (const struct context_rmcios *context)
+{
+   transaction_lock ();
+   if (transaction_flushing)
+   {
+      transaction_unlock ();
+      return;
+   }
+   transaction_flushing = 1;
+   while (transaction_outbox != NULL)
+   {
+      struct transaction_output *o = transaction_outbox;
+      transaction_outbox = o->next;
+      if (transaction_outbox == NULL)
+         transaction_outbox_tail = &transaction_outbox;
+      transaction_unlock ();
+
+      if (o->length >= 0)
+         write_buffer (context, o->channel, o->data, o->length, 0);
+      else
+         run_channel (context, o->channel, write_rmcios, int_rmcios, 0,
+                      0, (const union param_rmcios) 0);
+      free (o);
+
+      transaction_lock ();
+   }
+   transaction_flushing = 0;
+   transaction_unlock ();
+}
+
+// Send transaction and arm its timeout
+void transaction_send (struct transaction *t)
+{
+   t->deadline = monotonic_time () + t->timeout;
+   transaction_heap_push (t);
+   transaction_output (t->manager->transport, t->request,
+                       t->request_length);
+}
+
+// Send queued transactions while pipeline has room
+void transaction_pump (const struct context_rmcios *context,
+                       struct transaction_manager *this)
+{
+   struct transaction *t = this->queue;
+   int i = 0;
+   while (t != NULL && i < this->depth)
+   {
+      if (!t->sent)
+      {
+         t->sent = 1;
+         this->inflight++;
+         transaction_send (t);
+      }
+      t = t->next;
+      i++;
+   }
+}
+
+// Return all sent transactions to unsent state and drop received data.
+// Responses arrive in order, so after a timeout the whole pipeline is
+// sent again from the head.
+void transaction_restart (struct transaction_manager *this)
+{
+   struct transaction *t;
+   for (t = this->queue; t != NULL && t->sent; t = t->next)
+   {
+      transaction_heap_remove (t);
+      t->sent = 0;
+   }
+   this->inflight = 0;
+   this->rx_length = 0;
+}
+
+// Remove first transaction from the queue and deliver the response.
+// Response NULL delivers empty write (timeout).
+void transaction_complete (const struct context_rmcios *context,
+                           struct transaction_manager *this,
+                           const char *response, int length)
+{
+   struct transaction *t = this->queue;
+   this->queue = t->next;
+   this->queued--;
+   if (t->sent)
+      this->inflight--;
+   transaction_heap_remove (t);
+
+   if (response != NULL)
+   {
+      this->completed++;
+      transaction_output (t->reply_channel, response, length);
+   }
+   else
+   {
+      this->timeouts++;
+      transaction_output (t->reply_channel, NULL, -1);
+   }
+   free (t);
+   transaction_pump (context, this);
+}
+
+// Complete transactions whose responses are in the rx buffer
+void transaction_match (const struct context_rmcios *context,
+                        struct transaction_manager *this)
+{
+   while (this->queue != NULL && this->queue->sent && this->rx_length > 0)
+   {
+      struct transaction *t = this->queue;
+      int end = 0;
+      if (t->length > 0)
+      {
+         if (this->rx_length >= t->length)
+            end = t->length;
+      }
+      else
+      {
+         int i;
+         for (i = 0; i + t->terminator_length <= this->rx_length; i++)
+         {
+            if (memcmp (this->rx + i, t->terminator,
+                        t->terminator_length) == 0)
+            {
+               end = i + t->terminator_length;
+               break;
+            }
+         }
+      }
+      if (end == 0)
+         break;
+      {
+         char response[end];
+         memcpy (response, this->rx, end);
+         this->rx_length -= end;
+         memmove (this->rx, this->rx + end, this->rx_length);
+         transaction_complete (context, this, response, end);
+      }
+   }
+}
+
+// Handle expired deadlines of all managers. Returns time to next deadline.
+double transaction_expire (const struct context_rmcios *context)
+{
+   double now = monotonic_time ();
+   while (transaction_heap_size > 0)
+   {
+      struct transaction *t = transaction_heap[0];
+      struct transaction_manager *this = t->manager;
+      if (t->deadline > now)
+         return t->deadline - now;
+
+      transaction_heap_remove (t);
+      if (t != this->queue)
+      {
+         // Earlier transaction still pending. Give it the same time.
+         t->deadline = now + t->timeout;
+         transaction_heap_push (t);
+         continue;
+      }
+
+      // Head timed out. Data received after it belongs to no request.
+      transaction_restart (this);
+      if (t->retries > 0)
+      {
+         t->retries--;
+         this->retransmits++;
+         transaction_pump (context, this);
+      }
+      else
+         transaction_complete (context, this, NULL, 0);
+   }
+   return -1;
+}
+
+#ifdef __linux__
+void *transaction_timer_thread (void *data)
+{
+   pthread_mutex_lock (&transaction_mutex);
+   for (;;)
+   {
+      double wait = transaction_expire (transaction_context);
+      if (transaction_outbox != NULL && !transaction_flushing)
+      {
+         // Retransmits and timeouts are written without the lock
+         pthread_mutex_unlock (&transaction_mutex);
+         transaction_flush (transaction_context);
+         pthread_mutex_lock (&transaction_mutex);
+         continue;
+      }
+      if (wait < 0)
+         pthread_cond_wait (&transaction_timer_changed, &transaction_mutex);
+      else
+      {
+         struct timespec ts;
+         clock_gettime (CLOCK_MONOTONIC, &ts);
+         ts.tv_sec += (time_t) wait;
+         ts.tv_nsec += (wait - (time_t) wait) * 1e9;
+         if (ts.tv_nsec >= 1000000000)
+         {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+         }
+         pthread_cond_timedwait (&transaction_timer_changed,
+                                 &transaction_mutex, &ts);
+      }
+   }
+   return NULL;
+}
+
+void transaction_timer_init (const struct context_rmcios *context)
+{
+   pthread_mutexattr_t mattr;
+   pthread_condattr_t cattr;
+   if (transaction_initialized)
+      return;
+   transaction_initialized = 1;
+   pthread_mutexattr_init (&mattr);
+   pthread_mutexattr_settype (&mattr, PTHREAD_MUTEX_RECURSIVE);
+   pthread_mutex_init (&transaction_mutex, &mattr);
+   pthread_mutexattr_destroy (&mattr);
+   pthread_condattr_init (&cattr);
+   pthread_condattr_setclock (&cattr, CLOCK_MONOTONIC);
+   pthread_cond_init (&transaction_timer_changed, &cattr);
+   pthread_condattr_destroy (&cattr);
+   transaction_context = context;
+   if (pthread_create (&transaction_thread, NULL, transaction_timer_thread,
+                       NULL) != 0)
+      info (context, context->errors,
+            "transaction: Could not start timer thread."
+            " Timeouts are handled on empty write.\r\n");
+}
+#endif
+
+// Copy string with \r \n \t \\ and \xHH escapes decoded. Returns length.
+int transaction_unescape (char *dest, int size, const char *src)
+{
+   int length = 0;
+   while (*src != 0 && length < size)
+   {
+      char c = *src++;
+      if (c == '\\' && *src != 0)
+      {
+         c = *src++;
+         switch (c)
+         {
+         case 'r':
+            c = '\r';
+            break;
+         case 'n':
+            c = '\n';
+            break;
+         case 't':
+            c = '\t';
+            break;
+         case 'x':
+            {
+               char hex[3] = { 0, 0, 0 };
+               int i;
+               for (i = 0; i < 2 && isxdigit ((unsigned char) *src); i++)
+                  hex[i] = *src++;
+               c = strtol (hex, NULL, 16);
+            }
+            break;
+         default:
+            break;
+         }
+      }
+      dest[length++] = c;
+   }
+   return length;
+}
+
+// Queue new request. Returns 0 on success.
+int transaction_submit (const struct context_rmcios *context,
+                        struct transaction_manager *this, int reply_channel,
+                        const char *request, int request_length,
+                        const char *terminator, int terminator_length,
+                        int length, float timeout, int retries)
+{
+   struct transaction *t = malloc (sizeof (*t) + request_length);
+   struct transaction **last;
+   if (t == NULL)
+      return -1;
+   t->manager = this;
+   t->next = NULL;
+   t->reply_channel = reply_channel;
+   if (terminator_length > TRANSACTION_MAX_TERMINATOR)
+      terminator_length = TRANSACTION_MAX_TERMINATOR;
+   memcpy (t->terminator, terminator, terminator_length);
+   t->terminator_length = terminator_length;
+   t->length = length;
+   if (t->length <= 0 && t->terminator_length == 0)
+      t->length = 1;
+   t->timeout = timeout;
+   t->retries = retries;
+   t->sent = 0;
+   t->heap_index = -1;
+   t->request_length = request_length;
+   memcpy (t->request, request, request_length);
+
+   transaction_lock ();
+   for (last = &this->queue; *last != NULL; last = &(*last)->next);
+   *last = t;
+   this->queued++;
+   transaction_pump (context, this);
+   transaction_unlock ();
+   transaction_flush (context);
+   return 0;
+}
+
+void transaction_rx_subchan_func (struct transaction_manager *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
+{
+   if (this == NULL || function != write_rmcios || num_params < 1)
+      return;
+   {
+      int plen = param_buffer_alloc_size (context, paramtype, param, 0);
+      char pbuf[plen];
+      struct buffer_rmcios b;
+      b = param_to_buffer (context, paramtype, param, 0, plen, pbuf);
+
+      transaction_lock ();
+      // Unsolicited data is discarded
+      if (this->inflight > 0)
+      {
+         int n = b.length;
+         if (n > TRANSACTION_RX_SIZE - this->rx_length)
+            n = TRANSACTION_RX_SIZE - this->rx_length;
+         memcpy (this->rx + this->rx_length, b.data, n);
+         this->rx_length += n;
+         transaction_match (context, this);
+      }
+      transaction_unlock ();
+      transaction_flush (context);
+   }
+}
+
+void transaction_request_subchan_func (struct transaction_manager *this,
+                                       const struct context_rmcios *context,
+                                       int id, enum function_rmcios function,
+                                       enum type_rmcios paramtype,
+                                       struct combo_rmcios *returnv,
+                                       int num_params,
+                                       const union param_rmcios param)
+{
+   char terminator[TRANSACTION_MAX_TERMINATOR];
+   int terminator_length;
+   int length = 0;
+   float timeout;
+   int retries;
+
+   if (this == NULL || function != write_rmcios || num_params < 2)
+      return;
+
+   memcpy (terminator, this->terminator, this->terminator_length);
+   terminator_length = this->terminator_length;
+   timeout = this->timeout;
+   retries = this->retries;
+   if (num_params >= 3)
+   {
+      char str[4 * TRANSACTION_MAX_TERMINATOR + 1];
+      param_to_string (context, paramtype, param, 2, sizeof (str), str);
+      terminator_length =
+         transaction_unescape (terminator, TRANSACTION_MAX_TERMINATOR, str);
+   }
+   if (num_params >= 4)
+      length = param_to_int (context, paramtype, param, 3);
+   if (num_params >= 5)
+      timeout = param_to_float (context, paramtype, param, 4);
+   if (num_params >= 6)
+      retries = param_to_int (context, paramtype, param, 5);
+   {
+      int plen = param_buffer_alloc_size (context, paramtype, param, 1);
+      char pbuf[plen];
+      struct buffer_rmcios b;
+      b = param_to_buffer (context, paramtype, param, 1, plen, pbuf);
+      transaction_submit (context, this,
+                          param_to_int (context, paramtype, param, 0),
+                          b.data, b.length, terminator, terminator_length,
+                          length, timeout, retries);
+   }
+}
+
+void transaction_class_func (struct transaction_manager *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "request/response transaction manager help\r\n"
+                     "Serializes requests to a transport channel and"
+                     " delivers each response to its reply channel.\r\n"
+                     " create transaction newname\r\n"
+                     " setup newname transport | depth timeout retries"
+                     " terminator\r\n"
+                     "  -depth: requests in flight at once (default 1)\r\n"
+                     "  -timeout: seconds (default 1)\r\n"
+                     "  -retries: resends after timeout (default 0)\r\n"
+                     "  -terminator: end of response (default \\n)."
+                     " Escapes \\r \\n \\t \\xHH\r\n"
+                     " write newname_request reply_channel request"
+                     " | terminator length timeout retries\r\n"
+                     "  -length: >0 fixed response length instead of"
+                     " terminator\r\n"
+                     "  -response is written to reply_channel."
+                     " Empty write on timeout\r\n"
+                     " write newname_rx data # received data."
+                     " Linked from transport on setup\r\n"
+                     " write newname # handle expired timeouts"
+                     " (without timer thread)\r\n"
+                     " read newname \r\n"
+                     "  -returns: queued inflight completed timeouts"
+                     " retransmits\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      this = (struct transaction_manager *)
+         allocate_storage (context, sizeof (struct transaction_manager), 0);
+      if (this == NULL)
+         break;
+#ifdef __linux__
+      transaction_timer_init (context);
+#endif
+      this->transport = 0;
+      this->depth = 1;
+      this->timeout = 1;
+      this->retries = 0;
+      this->terminator[0] = '\n';
+      this->terminator_length = 1;
+      this->queue = NULL;
+      this->queued = 0;
+      this->inflight = 0;
+      this->rx_length = 0;
+      this->completed = 0;
+      this->timeouts = 0;
+      this->retransmits = 0;
+
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) transaction_class_func,
+                                       this);
+      create_subchannel_str (context, this->id, "_request",
+                             (class_rmcios) transaction_request_subchan_func,
+                             this);
+      this->rx_channel =
+         create_subchannel_str (context, this->id, "_rx",
+                                (class_rmcios) transaction_rx_subchan_func,
+                                this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      transaction_lock ();
+      this->transport = param_to_int (context, paramtype, param, 0);
+      link_channel (context, this->transport, this->rx_channel);
+      if (num_params >= 2)
+         this->depth = param_to_int (context, paramtype, param, 1);
+      if (this->depth < 1)
+         this->depth = 1;
+      if (num_params >= 3)
+         this->timeout = param_to_float (context, paramtype, param, 2);
+      if (num_params >= 4)
+         this->retries = param_to_int (context, paramtype, param, 3);
+      if (num_params >= 5)
+      {
+         char str[4 * TRANSACTION_MAX_TERMINATOR + 1];
+         param_to_string (context, paramtype, param, 4, sizeof (str), str);
+         this->terminator_length =
+            transaction_unescape (this->terminator,
+                                  TRANSACTION_MAX_TERMINATOR, str);
+      }
+      transaction_unlock ();
+      break;
+
+   case write_rmcios:
+      transaction_lock ();
+      transaction_expire (context);
+      transaction_unlock ();
+      transaction_flush (context);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      transaction_lock ();
+      return_int (context, returnv, this->queued - this->inflight);
+      return_int (context, returnv, this->inflight);
+      return_int (context, returnv, this->completed);
+      return_int (context, returnv, this->timeouts);
+      return_int (context, returnv, this->retransmits);
+      transaction_unlock ();
+      break;
+
+   default:
+      break;
+   }
+}
+
+void init_std_device_channels (const struct context_rmcios *context)
+{
+   // Device channels
+   create_channel_str (context, "tsi4000",
+                       (class_rmcios) tsi_flow_class_func, NULL);
+   create_channel_str (context, "atm_hv", (class_rmcios) atm_hv_class_func,
+                       NULL);
+   create_channel_str (context, "pt",
+                       (class_rmcios) pt_temperature_class_func, NULL);
+   create_channel_str (context, "conc", (class_rmcios) conc_class_func, NULL);
+   create_channel_str (context, "transaction",
+                       (class_rmcios) transaction_class_func, NULL);
+
+   modbus_crc_init ();
+   create_channel_str (context, "modbus_rtu",
+                       (class_rmcios) modbus_rtu_class_func, NULL);
+   create_channel_str (context, "modbus_poll",
+                       (class_rmcios) modbus_poll_class_func, NULL);
+   create_channel_str (context, "modbus_sim",
+                       (class_rmcios) modbus_sim_class_func, NULL);
 }
 
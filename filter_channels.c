@@ -0,0 +1,1316 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Signal filtering channels
+ *
+ * Changelog: (date,who,description)
+ */
+
+#include "RMCIOS-functions.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector_kernels.h"
+
+////////////////////////////////////////////////
+// FIR / IIR filter channel
+////////////////////////////////////////////////
+
+#define FILTER_PI 3.14159265358979
+
+struct filter_data
+{
+   int id;
+   int lanes;        // Independent signals filtered in parallel
+
+   // FIR
+   int taps;
+   float *h;         // Coefficients
+   float *fir_buffer; // Input history followed by current block
+   int fir_frames;   // Block capacity of fir_buffer in frames
+
+   // IIR biquad cascade
+   int sections;
+   float *coef;      // b0 b1 b2 a1 a2 per section
+   float *z1;        // State per section and lane
+   float *z2;
+
+   float *block;     // Write samples converted to float
+   int block_size;
+   float *last;      // Latest output frame
+};
+
+// Make sure buffers fit frames*lanes samples.
+int filter_reserve (struct filter_data *this, int frames)
+{
+   int size = frames * this->lanes;
+   if (size > this->block_size)
+   {
+      float *block = realloc (this->block, size * sizeof (float));
+      if (block == NULL)
+         return 0;
+      this->block = block;
+      this->block_size = size;
+   }
+   if (this->taps > 0 && frames > this->fir_frames)
+   {
+      int history = (this->taps - 1) * this->lanes;
+      float *buffer = realloc (this->fir_buffer,
+                               (history + size) * sizeof (float));
+      if (buffer == NULL)
+         return 0;
+      this->fir_buffer = buffer;
+      this->fir_frames = frames;
+   }
+   return 1;
+}
+
+void filter_reset (struct filter_data *this)
+{
+   if (this->fir_buffer != NULL)
+      memset (this->fir_buffer, 0,
+              (this->taps - 1 + this->fir_frames) * this->lanes
+              * sizeof (float));
+   if (this->z1 != NULL)
+      memset (this->z1, 0, this->sections * this->lanes * sizeof (float));
+   if (this->z2 != NULL)
+      memset (this->z2, 0, this->sections * this->lanes * sizeof (float));
+   if (this->last != NULL)
+      memset (this->last, 0, this->lanes * sizeof (float));
+}
+
+void filter_free (struct filter_data *this)
+{
+   free (this->h);
+   free (this->fir_buffer);
+   free (this->coef);
+   free (this->z1);
+   free (this->z2);
+   free (this->block);
+   free (this->last);
+   this->h = NULL;
+   this->fir_buffer = NULL;
+   this->coef = NULL;
+   this->z1 = NULL;
+   this->z2 = NULL;
+   this->block = NULL;
+   this->last = NULL;
+   this->taps = 0;
+   this->sections = 0;
+   this->fir_frames = 0;
+   this->block_size = 0;
+}
+
+// Allocate coefficient and state storage. Returns 0 on failure.
+int filter_allocate (struct filter_data *this, int taps, int sections)
+{
+   int lanes = this->lanes;
+   filter_free (this);
+   this->last = calloc (lanes, sizeof (float));
+   if (taps > 0)
+      this->h = calloc (taps, sizeof (float));
+   if (sections > 0)
+   {
+      this->coef = calloc (sections * 5, sizeof (float));
+      this->z1 = calloc (sections * lanes, sizeof (float));
+      this->z2 = calloc (sections * lanes, sizeof (float));
+   }
+   if (this->last == NULL || (taps > 0 && this->h == NULL)
+       || (sections > 0 && (this->coef == NULL || this->z1 == NULL
+                            || this->z2 == NULL)))
+   {
+      filter_free (this);
+      return 0;
+   }
+   this->taps = taps;
+   this->sections = sections;
+   if (!filter_reserve (this, 1))
+   {
+      filter_free (this);
+      return 0;
+   }
+   filter_reset (this);
+   return 1;
+}
+
+// Filter frames*lanes interleaved samples in place.
+void filter_process (struct filter_data *this, float *x, int frames)
+{
+   int lanes = this->lanes;
+   int size = frames * lanes;
+   int i, s;
+
+   if (this->taps > 0)
+   {
+      // Each tap adds a shifted copy of the input: y += h[k] * x[n-k]
+      int history = (this->taps - 1) * lanes;
+      float *buffer = this->fir_buffer;
+      memcpy (buffer + history, x, size * sizeof (float));
+      memset (x, 0, size * sizeof (float));
+      for (i = 0; i < this->taps; i++)
+         vector_axpy (x, this->h[i],
+                      buffer + (this->taps - 1 - i) * lanes, size);
+      memmove (buffer, buffer + size, history * sizeof (float));
+   }
+
+   for (s = 0; s < this->sections; s++)
+   {
+      const float *c = this->coef + s * 5;
+      float *z1 = this->z1 + s * lanes;
+      float *z2 = this->z2 + s * lanes;
+      if (lanes == 1)
+      {
+         float b0 = c[0], b1 = c[1], b2 = c[2], a1 = c[3], a2 = c[4];
+         float s1 = *z1, s2 = *z2;
+         for (i = 0; i < frames; i++)
+         {
+            float in = x[i];
+            float out = b0 * in + s1;
+            s1 = b1 * in - a1 * out + s2;
+            s2 = b2 * in - a2 * out;
+            x[i] = out;
+         }
+         *z1 = s1;
+         *z2 = s2;
+      }
+      else
+      {
+         for (i = 0; i < frames; i++)
+            vector_biquad (c, x + i * lanes, z1, z2, lanes);
+      }
+   }
+
+   if (frames > 0)
+      memcpy (this->last, x + (frames - 1) * lanes, lanes * sizeof (float));
+}
+
+// Butterworth biquad cascade. First order section when order is odd.
+void filter_design_butterworth (struct filter_data *this, int highpass,
+                                float cutoff, float samplerate, int order)
+{
+   double w0 = 2 * FILTER_PI * cutoff / samplerate;
+   double cw = cos (w0);
+   double sw = sin (w0);
+   int pairs = order / 2;
+   int k;
+
+   for (k = 0; k < pairs; k++)
+   {
+      float *c = this->coef + k * 5;
+      double angle = (order % 2) ? FILTER_PI * (k + 1) / order
+                                 : FILTER_PI * (2 * k + 1) / (2 * order);
+      double q = 1 / (2 * cos (angle));
+      double alpha = sw / (2 * q);
+      double a0 = 1 + alpha;
+      if (highpass)
+      {
+         c[0] = (1 + cw) / 2 / a0;
+         c[1] = -(1 + cw) / a0;
+      }
+      else
+      {
+         c[0] = (1 - cw) / 2 / a0;
+         c[1] = (1 - cw) / a0;
+      }
+      c[2] = c[0];
+      c[3] = -2 * cw / a0;
+      c[4] = (1 - alpha) / a0;
+   }
+   if (order % 2)
+   {
+      float *c = this->coef + pairs * 5;
+      double K = tan (w0 / 2);
+      c[0] = highpass ? 1 / (1 + K) : K / (1 + K);
+      c[1] = highpass ? -c[0] : c[0];
+      c[2] = 0;
+      c[3] = (K - 1) / (K + 1);
+      c[4] = 0;
+   }
+}
+
+// Hamming windowed sinc. Highpass by spectral inversion (odd taps).
+void filter_design_fir (struct filter_data *this, int highpass,
+                        float cutoff, float samplerate)
+{
+   double fc = cutoff / samplerate;
+   double middle = (this->taps - 1) / 2.0;
+   double sum = 0;
+   int i;
+
+   for (i = 0; i < this->taps; i++)
+   {
+      double n = i - middle;
+      double sinc = (n == 0) ? 2 * fc : sin (2 * FILTER_PI * fc * n)
+                                        / (FILTER_PI * n);
+      double window = 0.54 - 0.46 * cos (2 * FILTER_PI * i
+                                         / (this->taps > 1 ?
+                                            this->taps - 1 : 1));
+      this->h[i] = sinc * window;
+      sum += this->h[i];
+   }
+   for (i = 0; i < this->taps; i++)
+   {
+      this->h[i] /= sum;
+      if (highpass)
+         this->h[i] = -this->h[i];
+   }
+   if (highpass)
+      this->h[this->taps / 2] += 1;
+}
+
+void filter_class_func (struct filter_data *this,
+                        const struct context_rmcios *context, int id,
+                        enum function_rmcios function,
+                        enum type_rmcios paramtype,
+                        struct combo_rmcios *returnv,
+                        int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "help for FIR/IIR filter channel:\r\n"
+                     " create filter newname\r\n"
+                     " setup newname fir h0 h1 h2 ...\r\n"
+                     "  -FIR filter with given taps\r\n"
+                     " setup newname iir b0 b1 b2 a1 a2 | b0 ...\r\n"
+                     "  -cascade of biquad sections (a0=1)\r\n"
+                     " setup newname lowpass cutoff samplerate | order\r\n"
+                     " setup newname highpass cutoff samplerate | order\r\n"
+                     "  -Butterworth IIR filter. Default order 2\r\n"
+                     " setup newname fir_lowpass cutoff samplerate taps\r\n"
+                     " setup newname fir_highpass cutoff samplerate taps\r\n"
+                     "  -Hamming windowed FIR filter\r\n"
+                     " setup newname lanes n\r\n"
+                     "  -filter n independent signals in parallel (1)\r\n"
+                     " write newname value1 value2 ...\r\n"
+                     "  -filter samples. With n lanes the values are\r\n"
+                     "   frames of n samples, one per lane.\r\n"
+                     "   Outputs are sent to linked channels.\r\n"
+                     " write newname #reset filter state\r\n"
+                     " read newname #read latest output frame\r\n"
+                     " link newname channel #link output to channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+
+      // allocate new data
+      this = (struct filter_data *)
+             allocate_storage (context, sizeof (struct filter_data), 0);
+      if (this == NULL)
+         break;
+
+      //default values :
+      memset (this, 0, sizeof (struct filter_data));
+      this->lanes = 1;
+
+      // Pass through until configured
+      filter_allocate (this, 0, 0);
+
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) filter_class_func,
+                                       this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      {
+         char type[16];
+         int i;
+         param_to_string (context, paramtype, param, 0, sizeof (type), type);
+
+         if (strcmp (type, "lanes") == 0)
+         {
+            // Keep coefficients, reallocate state for the new lanes
+            int lanes = param_to_int (context, paramtype, param, 1);
+            int taps = this->taps;
+            int sections = this->sections;
+            float *h = this->h;
+            float *coef = this->coef;
+            if (lanes < 1)
+               lanes = 1;
+            this->h = NULL;
+            this->coef = NULL;
+            this->lanes = lanes;
+            if (filter_allocate (this, taps, sections))
+            {
+               if (taps > 0)
+                  memcpy (this->h, h, taps * sizeof (float));
+               if (sections > 0)
+                  memcpy (this->coef, coef, sections * 5 * sizeof (float));
+            }
+            free (h);
+            free (coef);
+         }
+         else if (strcmp (type, "fir") == 0)
+         {
+            if (filter_allocate (this, num_params - 1, 0))
+            {
+               for (i = 0; i < this->taps; i++)
+                  this->h[i] = param_to_float (context, paramtype, param,
+                                               i + 1);
+            }
+         }
+         else if (strcmp (type, "iir") == 0)
+         {
+            if (filter_allocate (this, 0, (num_params - 1) / 5))
+            {
+               for (i = 0; i < this->sections * 5; i++)
+                  this->coef[i] = param_to_float (context, paramtype, param,
+                                                  i + 1);
+            }
+         }
+         else if (strcmp (type, "lowpass") == 0
+                  || strcmp (type, "highpass") == 0)
+         {
+            int order = 2;
+            float cutoff, samplerate;
+            if (num_params < 3)
+               break;
+            cutoff = param_to_float (context, paramtype, param, 1);
+            samplerate = param_to_float (context, paramtype, param, 2);
+            if (num_params > 3)
+               order = param_to_int (context, paramtype, param, 3);
+            if (order < 1)
+               order = 1;
+            if (filter_allocate (this, 0, (order + 1) / 2))
+               filter_design_butterworth (this, type[0] == 'h', cutoff,
+                                          samplerate, order);
+         }
+         else if (strcmp (type, "fir_lowpass") == 0
+                  || strcmp (type, "fir_highpass") == 0)
+         {
+            int highpass = (strcmp (type, "fir_highpass") == 0);
+            int taps;
+            float cutoff, samplerate;
+            if (num_params < 4)
+               break;
+            cutoff = param_to_float (context, paramtype, param, 1);
+            samplerate = param_to_float (context, paramtype, param, 2);
+            taps = param_to_int (context, paramtype, param, 3);
+            if (taps < 1)
+               taps = 1;
+            if (highpass && taps % 2 == 0)
+               taps++;
+            if (filter_allocate (this, taps, 0))
+               filter_design_fir (this, highpass, cutoff, samplerate);
+         }
+         else
+         {
+            info (context, context->errors,
+                  "filter: Unknown filter type!\r\n");
+            break;
+         }
+         if (this->last == NULL)
+            info (context, context->errors,
+                  "filter: Could not allocate filter!\r\n");
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL || this->last == NULL)
+         break;
+      if (num_params < 1)
+      {
+         filter_reset (this);
+         break;
+      }
+      {
+         int frames = num_params / this->lanes;
+         int i;
+         if (frames < 1)
+            break;
+         if (!filter_reserve (this, frames))
+         {
+            info (context, context->errors,
+                  "filter: Could not allocate block!\r\n");
+            break;
+         }
+         for (i = 0; i < frames * this->lanes; i++)
+            this->block[i] = param_to_float (context, paramtype, param, i);
+         filter_process (this, this->block, frames);
+         if (frames * this->lanes == 1)
+            write_f (context, linked_channels (context, id), this->block[0]);
+         else
+            write_fv (context, linked_channels (context, id),
+                      frames * this->lanes, this->block);
+      }
+      break;
+
+   case read_rmcios:
+      if (this == NULL || this->last == NULL)
+         break;
+      {
+         int i;
+         for (i = 0; i < this->lanes; i++)
+            return_float (context, returnv, this->last[i]);
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+////////////////////////////////////////////////
+// Moving median / Hampel outlier filter channel
+////////////////////////////////////////////////
+
+#define MEDIAN_MAX_LEVEL 16
+
+// Indexable skip list node. Links are pool indexes.
+struct median_node
+{
+   float value;
+   unsigned long seq;  // Arrival order, makes equal values unique
+   int level;
+   int next[MEDIAN_MAX_LEVEL];
+   int width[MEDIAN_MAX_LEVEL];  // Rank distance to next node
+};
+
+struct median_data
+{
+   int id;
+   int window;
+   struct median_node *nodes;  // window samples + head + tail
+   int *ring;                  // Nodes in arrival order
+   int head;
+   int tail;
+   int count;
+   unsigned long seq;
+   unsigned int random;
+
+   float threshold;            // 0 for plain median filter
+   int substitute_last;        // Replace outliers with last valid value
+   float last_valid;
+   float output;
+   int outliers;
+};
+
+// Node ordering: value, then arrival
+int median_node_less (struct median_node *a, float value, unsigned long seq)
+{
+   return a->value < value || (a->value == value && a->seq < seq);
+}
+
+int median_random_level (struct median_data *this)
+{
+   int level = 1;
+   // xorshift32
+   this->random ^= this->random << 13;
+   this->random ^= this->random >> 17;
+   this->random ^= this->random << 5;
+   {
+      unsigned int bits = this->random;
+      while ((bits & 1) && level < MEDIAN_MAX_LEVEL)
+      {
+         level++;
+         bits >>= 1;
+      }
+   }
+   return level;
+}
+
+void median_reset (struct median_data *this)
+{
+   struct median_node *head = this->nodes + this->window;
+   struct median_node *tail = this->nodes + this->window + 1;
+   int l;
+   for (l = 0; l < MEDIAN_MAX_LEVEL; l++)
+   {
+      head->next[l] = this->window + 1;
+      head->width[l] = 1;
+   }
+   head->level = MEDIAN_MAX_LEVEL;
+   tail->value = INFINITY;
+   tail->seq = (unsigned long) -1;
+   tail->level = 0;
+   this->head = 0;
+   this->tail = 0;
+   this->count = 0;
+   this->outliers = 0;
+   this->last_valid = NAN;
+   this->output = NAN;
+   // Free nodes are kept in ring order: slot i uses node i initially
+   for (l = 0; l < this->window; l++)
+      this->ring[l] = l;
+}
+
+// Find the last node before (value, seq) on every level
+void median_search (struct median_data *this, float value,
+                    unsigned long seq, int *chain, int *steps)
+{
+   int node = this->window;
+   int l;
+   for (l = MEDIAN_MAX_LEVEL - 1; l >= 0; l--)
+   {
+      steps[l] = 0;
+      while (median_node_less (this->nodes + this->nodes[node].next[l],
+                               value, seq))
+      {
+         steps[l] += this->nodes[node].width[l];
+         node = this->nodes[node].next[l];
+      }
+      chain[l] = node;
+   }
+}
+
+void median_insert (struct median_data *this, int index, float value)
+{
+   struct median_node *nodes = this->nodes;
+   struct median_node *node = nodes + index;
+   int chain[MEDIAN_MAX_LEVEL];
+   int steps[MEDIAN_MAX_LEVEL];
+   int distance = 0;
+   int l;
+
+   node->value = value;
+   node->seq = this->seq++;
+   node->level = median_random_level (this);
+   median_search (this, value, node->seq, chain, steps);
+   for (l = 0; l < node->level; l++)
+   {
+      struct median_node *prev = nodes + chain[l];
+      node->next[l] = prev->next[l];
+      prev->next[l] = index;
+      node->width[l] = prev->width[l] - distance;
+      prev->width[l] = distance + 1;
+      distance += steps[l];
+   }
+   for (; l < MEDIAN_MAX_LEVEL; l++)
+      nodes[chain[l]].width[l]++;
+   this->count++;
+}
+
+void median_remove (struct median_data *this, int index)
+{
+   struct median_node *nodes = this->nodes;
+   struct median_node *node = nodes + index;
+   int chain[MEDIAN_MAX_LEVEL];
+   int steps[MEDIAN_MAX_LEVEL];
+   int l;
+
+   median_search (this, node->value, node->seq, chain, steps);
+   for (l = 0; l < node->level; l++)
+   {
+      struct median_node *prev = nodes + chain[l];
+      prev->width[l] += node->width[l] - 1;
+      prev->next[l] = node->next[l];
+   }
+   for (; l < MEDIAN_MAX_LEVEL; l++)
+      nodes[chain[l]].width[l]--;
+   this->count--;
+}
+
+// Value at rank (0 = smallest)
+float median_rank (struct median_data *this, int rank)
+{
+   int node = this->window;
+   int l;
+   rank++;
+   for (l = MEDIAN_MAX_LEVEL - 1; l >= 0; l--)
+   {
+      while (this->nodes[node].width[l] <= rank)
+      {
+         rank -= this->nodes[node].width[l];
+         node = this->nodes[node].next[l];
+      }
+   }
+   return this->nodes[node].value;
+}
+
+// Linearly interpolated quantile, q = 0...1
+float median_quantile (struct median_data *this, float q)
+{
+   float position, low;
+   int rank;
+   if (this->count == 0)
+      return NAN;
+   position = q * (this->count - 1);
+   rank = (int) position;
+   low = median_rank (this, rank);
+   if (rank + 1 >= this->count)
+      return low;
+   return low + (position - rank) * (median_rank (this, rank + 1) - low);
+}
+
+// Add sample to window and return filtered value
+float median_push (struct median_data *this, float x)
+{
+   float median;
+   if (!isnan (x))
+   {
+      if (this->count == this->window)
+      {
+         median_remove (this, this->ring[this->head]);
+         this->head = (this->head + 1) % this->window;
+      }
+      // The slot freed by the oldest sample holds the next free node
+      median_insert (this, this->ring[this->tail], x);
+      this->tail = (this->tail + 1) % this->window;
+   }
+   median = median_quantile (this, 0.5);
+
+   if (this->threshold <= 0)
+      this->output = median;
+   else
+   {
+      // Gaussian equivalent standard deviation from interquartile range
+      float scale = (median_quantile (this, 0.75)
+                     - median_quantile (this, 0.25)) / 1.349;
+      if (isnan (x) || fabs (x - median) > this->threshold * scale)
+      {
+         this->outliers++;
+         this->output = this->substitute_last ? this->last_valid : median;
+      }
+      else
+      {
+         this->last_valid = x;
+         this->output = x;
+      }
+   }
+   return this->output;
+}
+
+void median_median_subchan_func (struct median_data *this,
+                                 const struct context_rmcios *context,
+                                 int id, enum function_rmcios function,
+                                 enum type_rmcios paramtype,
+                                 struct combo_rmcios *returnv,
+                                 int num_params,
+                                 const union param_rmcios param)
+{
+   if (function == read_rmcios)
+      return_float (context, returnv, median_quantile (this, 0.5));
+}
+
+void median_outliers_subchan_func (struct median_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   if (function == read_rmcios)
+      return_int (context, returnv, this->outliers);
+}
+
+void median_class_func (struct median_data *this,
+                        const struct context_rmcios *context, int id,
+                        enum function_rmcios function,
+                        enum type_rmcios paramtype,
+                        struct combo_rmcios *returnv,
+                        int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "help for moving median / Hampel filter channel:\r\n"
+                     " create median newname\r\n"
+                     " setup newname window | threshold substitute\r\n"
+                     "  -window: number of samples\r\n"
+                     "  -threshold: outlier limit in standard deviations\r\n"
+                     "   estimated from interquartile range.\r\n"
+                     "   0 outputs the median of window (default)\r\n"
+                     "  -substitute: value for outliers.\r\n"
+                     "   median (default) or last (last valid value)\r\n"
+                     " write newname value\r\n"
+                     "  -filter value. Result is sent to linked channels\r\n"
+                     "   NaN is always an outlier.\r\n"
+                     " write newname #clear window\r\n"
+                     " read newname #read latest output\r\n"
+                     " read newname_median #median of window\r\n"
+                     " read newname_outliers #number of rejected values\r\n"
+                     " link newname channel #link output to channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+
+      // allocate new data
+      this = (struct median_data *)
+             allocate_storage (context, sizeof (struct median_data), 0);
+      if (this == NULL)
+         break;
+
+      //default values :
+      memset (this, 0, sizeof (struct median_data));
+      this->random = 2463534242u;
+      this->output = NAN;
+      this->last_valid = NAN;
+
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) median_class_func,
+                                       this);
+      create_subchannel_str (context, this->id, "_median",
+                             (class_rmcios) median_median_subchan_func,
+                             this);
+      create_subchannel_str (context, this->id, "_outliers",
+                             (class_rmcios) median_outliers_subchan_func,
+                             this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         int window = param_to_int (context, paramtype, param, 0);
+         if (window < 1)
+            window = 1;
+         free (this->nodes);
+         free (this->ring);
+         this->nodes = malloc ((window + 2) * sizeof (struct median_node));
+         this->ring = malloc (window * sizeof (int));
+         this->window = window;
+         if (this->nodes == NULL || this->ring == NULL)
+         {
+            info (context, context->errors,
+                  "median: Could not allocate window!\r\n");
+            free (this->nodes);
+            free (this->ring);
+            this->nodes = NULL;
+            this->ring = NULL;
+            this->window = 0;
+            break;
+         }
+         median_reset (this);
+      }
+      this->threshold = 0;
+      this->substitute_last = 0;
+      if (num_params < 2)
+         break;
+      this->threshold = param_to_float (context, paramtype, param, 1);
+      if (num_params < 3)
+         break;
+      {
+         char substitute[8];
+         param_to_string (context, paramtype, param, 2,
+                          sizeof (substitute), substitute);
+         this->substitute_last = (strcmp (substitute, "last") == 0);
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL || this->window == 0)
+         break;
+      if (num_params < 1)
+      {
+         median_reset (this);
+         break;
+      }
+      write_f (context, linked_channels (context, id),
+               median_push (this,
+                            param_to_float (context, paramtype, param, 0)));
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_float (context, returnv, this->output);
+      break;
+
+   default:
+      break;
+   }
+}
+
+////////////////////////////////////////////////
+// Kalman filter channel
+////////////////////////////////////////////////
+
+#define KALMAN_MAX 8
+
+// State and covariance of every lane are stored lane-innermost
+// (x[i*lanes+lane], P[(i*n+j)*lanes+lane]) so each step of the filter
+// is one loop over all lanes.
+struct kalman_data
+{
+   int id;
+   int n;       // States
+   int m;       // Measurements
+   int lanes;   // Independent filters sharing the model
+
+   // Shared model
+   float F[KALMAN_MAX][KALMAN_MAX];  // State transition
+   float Q[KALMAN_MAX][KALMAN_MAX];  // Process noise covariance
+   float H[KALMAN_MAX][KALMAN_MAX];  // Measurement rows
+   float R[KALMAN_MAX];              // Measurement noise variances
+   float x0[KALMAN_MAX];             // Initial state
+   float P0[KALMAN_MAX][KALMAN_MAX]; // Initial covariance
+
+   // Allocated at setup
+   float *x;
+   float *P;
+   float *FP;    // Scratch, n*n or at least 2 values per lane
+   float *ph;    // n*lanes scratch
+   float *z;     // m*lanes measurements
+};
+
+void kalman_reset (struct kalman_data *this)
+{
+   int lanes = this->lanes;
+   int i, j, l;
+   for (i = 0; i < this->n; i++)
+   {
+      for (l = 0; l < lanes; l++)
+         this->x[i * lanes + l] = this->x0[i];
+      for (j = 0; j < this->n; j++)
+         for (l = 0; l < lanes; l++)
+            this->P[(i * this->n + j) * lanes + l] = this->P0[i][j];
+   }
+}
+
+// Default model: random walk states measured directly.
+void kalman_default_model (struct kalman_data *this)
+{
+   int i, j;
+   memset (this->F, 0, sizeof (this->F));
+   memset (this->Q, 0, sizeof (this->Q));
+   memset (this->H, 0, sizeof (this->H));
+   memset (this->P0, 0, sizeof (this->P0));
+   memset (this->x0, 0, sizeof (this->x0));
+   for (i = 0; i < this->n; i++)
+   {
+      this->F[i][i] = 1;
+      this->Q[i][i] = 1e-3;
+      this->P0[i][i] = 1;
+   }
+   // Extra measurements observe the states again (redundant sensors)
+   for (j = 0; j < this->m; j++)
+   {
+      this->H[j][j % this->n] = 1;
+      this->R[j] = 1;
+   }
+}
+
+void kalman_free (struct kalman_data *this)
+{
+   free (this->x);
+   free (this->P);
+   free (this->FP);
+   free (this->ph);
+   free (this->z);
+   this->x = NULL;
+   this->P = NULL;
+   this->FP = NULL;
+   this->ph = NULL;
+   this->z = NULL;
+}
+
+int kalman_allocate (struct kalman_data *this)
+{
+   int n = this->n;
+   int lanes = this->lanes;
+   kalman_free (this);
+   this->x = malloc (n * lanes * sizeof (float));
+   this->P = malloc (n * n * lanes * sizeof (float));
+   this->FP = malloc ((n * n < 2 ? 2 : n * n) * lanes * sizeof (float));
+   this->ph = malloc (n * lanes * sizeof (float));
+   this->z = malloc (this->m * lanes * sizeof (float));
+   if (this->x == NULL || this->P == NULL || this->FP == NULL
+       || this->ph == NULL || this->z == NULL)
+   {
+      kalman_free (this);
+      return 0;
+   }
+   kalman_reset (this);
+   return 1;
+}
+
+// x = F x, P = F P F' + Q
+void kalman_predict (struct kalman_data *this)
+{
+   int n = this->n;
+   int lanes = this->lanes;
+   float *x = this->x;
+   float *P = this->P;
+   float *FP = this->FP;
+   float *tmp = this->ph;
+   int i, j, k, l;
+
+   for (i = 0; i < n; i++)
+   {
+      float *t = tmp + i * lanes;
+      for (l = 0; l < lanes; l++)
+         t[l] = 0;
+      for (k = 0; k < n; k++)
+      {
+         float f = this->F[i][k];
+         const float *xk = x + k * lanes;
+         if (f != 0)
+            for (l = 0; l < lanes; l++)
+               t[l] += f * xk[l];
+      }
+   }
+   memcpy (x, tmp, n * lanes * sizeof (float));
+
+   for (i = 0; i < n; i++)
+      for (j = 0; j < n; j++)
+      {
+         float *fp = FP + (i * n + j) * lanes;
+         for (l = 0; l < lanes; l++)
+            fp[l] = 0;
+         for (k = 0; k < n; k++)
+         {
+            float f = this->F[i][k];
+            const float *p = P + (k * n + j) * lanes;
+            if (f != 0)
+               for (l = 0; l < lanes; l++)
+                  fp[l] += f * p[l];
+         }
+      }
+
+   for (i = 0; i < n; i++)
+      for (j = 0; j < n; j++)
+      {
+         float *p = P + (i * n + j) * lanes;
+         float q = this->Q[i][j];
+         for (l = 0; l < lanes; l++)
+            p[l] = q;
+         for (k = 0; k < n; k++)
+         {
+            float f = this->F[j][k];
+            const float *fp = FP + (i * n + k) * lanes;
+            if (f != 0)
+               for (l = 0; l < lanes; l++)
+                  p[l] += fp[l] * f;
+         }
+      }
+}
+
+// Sequential scalar updates, one per measurement row.
+// NaN measurement leaves the lane unchanged.
+void kalman_update (struct kalman_data *this)
+{
+   int n = this->n;
+   int lanes = this->lanes;
+   float *x = this->x;
+   float *P = this->P;
+   float *ph = this->ph;
+   int i, j, k, l;
+
+   for (k = 0; k < this->m; k++)
+   {
+      const float *h = this->H[k];
+      const float *z = this->z + k * lanes;
+      float *gain = this->FP;       // Scratch: gain and innovation
+      float *innovation = this->FP + lanes;
+
+      // ph = P h'
+      for (i = 0; i < n; i++)
+      {
+         float *phi = ph + i * lanes;
+         for (l = 0; l < lanes; l++)
+            phi[l] = 0;
+         for (j = 0; j < n; j++)
+         {
+            const float *p = P + (i * n + j) * lanes;
+            if (h[j] != 0)
+               for (l = 0; l < lanes; l++)
+                  phi[l] += p[l] * h[j];
+         }
+      }
+
+      // s = h P h' + r, innovation = z - h x
+      for (l = 0; l < lanes; l++)
+      {
+         gain[l] = this->R[k];
+         innovation[l] = z[l];
+      }
+      for (i = 0; i < n; i++)
+      {
+         const float *phi = ph + i * lanes;
+         const float *xi = x + i * lanes;
+         if (h[i] != 0)
+            for (l = 0; l < lanes; l++)
+            {
+               gain[l] += h[i] * phi[l];
+               innovation[l] -= h[i] * xi[l];
+            }
+      }
+      for (l = 0; l < lanes; l++)
+      {
+         int valid = !isnan (z[l]) && gain[l] > 0;
+         gain[l] = valid ? 1 / gain[l] : 0;
+         innovation[l] = valid ? innovation[l] : 0;
+      }
+
+      // x += ph * innovation / s, P -= ph ph' / s
+      for (i = 0; i < n; i++)
+      {
+         const float *phi = ph + i * lanes;
+         float *xi = x + i * lanes;
+         for (l = 0; l < lanes; l++)
+            xi[l] += phi[l] * gain[l] * innovation[l];
+         for (j = 0; j < n; j++)
+         {
+            const float *phj = ph + j * lanes;
+            float *p = P + (i * n + j) * lanes;
+            for (l = 0; l < lanes; l++)
+               p[l] -= phi[l] * phj[l] * gain[l];
+         }
+      }
+   }
+}
+
+// Read setup values into a matrix row by row
+void kalman_setup_matrix (const struct context_rmcios *context,
+                          enum type_rmcios paramtype,
+                          const union param_rmcios param, int num_params,
+                          float matrix[KALMAN_MAX][KALMAN_MAX],
+                          int rows, int columns)
+{
+   int i;
+   for (i = 0; i < rows * columns && i + 1 < num_params; i++)
+      matrix[i / columns][i % columns] =
+         param_to_float (context, paramtype, param, i + 1);
+}
+
+void kalman_variance_subchan_func (struct kalman_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   int i, l;
+   if (function != read_rmcios || this->x == NULL)
+      return;
+   for (l = 0; l < this->lanes; l++)
+      for (i = 0; i < this->n; i++)
+         return_float (context, returnv,
+                       this->P[(i * this->n + i) * this->lanes + l]);
+}
+
+void kalman_class_func (struct kalman_data *this,
+                        const struct context_rmcios *context, int id,
+                        enum function_rmcios function,
+                        enum type_rmcios paramtype,
+                        struct combo_rmcios *returnv,
+                        int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "help for linear Kalman filter channel:\r\n"
+                     " create kalman newname\r\n"
+                     " setup newname size states measurements | lanes\r\n"
+                     "  -resets model. Max 8 states and measurements.\r\n"
+                     "  -lanes: number of independent filters sharing\r\n"
+                     "   the model (1)\r\n"
+                     "  -default model: F=I Q=0.001*I R=1 P=I x=0\r\n"
+                     "   measurement k observes state k%states\r\n"
+                     " setup newname F f11 f12 ... #state transition\r\n"
+                     " setup newname Q q11 q12 ... #process noise\r\n"
+                     " setup newname H h11 h12 ... #measurement matrix\r\n"
+                     " setup newname R r1 r2 ... #measurement variances\r\n"
+                     " setup newname x x1 x2 ... #initial state\r\n"
+                     " setup newname P p11 p12 ... #initial covariance\r\n"
+                     "  -matrices are given row by row\r\n"
+                     " write newname z1 z2 ... | z1 z2 ...\r\n"
+                     "  -predict and update with measurements of each\r\n"
+                     "   lane. nan for missing measurement.\r\n"
+                     "   States are sent to linked channels.\r\n"
+                     " write newname #reset to initial state\r\n"
+                     " read newname #read states of each lane\r\n"
+                     " read newname_variance #read state variances\r\n"
+                     " link newname channel #link states to channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+
+      // allocate new data
+      this = (struct kalman_data *)
+             allocate_storage (context, sizeof (struct kalman_data), 0);
+      if (this == NULL)
+         break;
+
+      //default values :
+      memset (this, 0, sizeof (struct kalman_data));
+      this->n = 1;
+      this->m = 1;
+      this->lanes = 1;
+      kalman_default_model (this);
+      kalman_allocate (this);
+
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) kalman_class_func,
+                                       this);
+      create_subchannel_str (context, this->id, "_variance",
+                             (class_rmcios) kalman_variance_subchan_func,
+                             this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      {
+         char type[8];
+         int i;
+         param_to_string (context, paramtype, param, 0, sizeof (type), type);
+
+         if (strcmp (type, "size") == 0)
+         {
+            if (num_params < 3)
+               break;
+            this->n = param_to_int (context, paramtype, param, 1);
+            this->m = param_to_int (context, paramtype, param, 2);
+            this->lanes = 1;
+            if (num_params > 3)
+               this->lanes = param_to_int (context, paramtype, param, 3);
+            if (this->n < 1)
+               this->n = 1;
+            if (this->n > KALMAN_MAX)
+               this->n = KALMAN_MAX;
+            if (this->m < 1)
+               this->m = 1;
+            if (this->m > KALMAN_MAX)
+               this->m = KALMAN_MAX;
+            if (this->lanes < 1)
+               this->lanes = 1;
+            kalman_default_model (this);
+            if (!kalman_allocate (this))
+               info (context, context->errors,
+                     "kalman: Could not allocate filter!\r\n");
+            break;
+         }
+
+         if (strcmp (type, "F") == 0)
+            kalman_setup_matrix (context, paramtype, param, num_params,
+                                 this->F, this->n, this->n);
+         else if (strcmp (type, "Q") == 0)
+            kalman_setup_matrix (context, paramtype, param, num_params,
+                                 this->Q, this->n, this->n);
+         else if (strcmp (type, "H") == 0)
+            kalman_setup_matrix (context, paramtype, param, num_params,
+                                 this->H, this->m, this->n);
+         else if (strcmp (type, "P") == 0)
+            kalman_setup_matrix (context, paramtype, param, num_params,
+                                 this->P0, this->n, this->n);
+         else if (strcmp (type, "R") == 0)
+         {
+            for (i = 0; i < this->m && i + 1 < num_params; i++)
+               this->R[i] = param_to_float (context, paramtype, param,
+                                            i + 1);
+         }
+         else if (strcmp (type, "x") == 0)
+         {
+            for (i = 0; i < this->n && i + 1 < num_params; i++)
+               this->x0[i] = param_to_float (context, paramtype, param,
+                                             i + 1);
+         }
+         else
+         {
+            info (context, context->errors,
+                  "kalman: Unknown setup parameter!\r\n");
+            break;
+         }
+         if (this->x != NULL)
+            kalman_reset (this);
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL || this->x == NULL)
+         break;
+      if (num_params < 1)
+      {
+         kalman_reset (this);
+         break;
+      }
+      {
+         int lanes = this->lanes;
+         int i, k, l;
+
+         // Measurements are given lane by lane, stored lane-innermost
+         for (l = 0; l < lanes; l++)
+            for (k = 0; k < this->m; k++)
+            {
+               i = l * this->m + k;
+               this->z[k * lanes + l] = (i < num_params) ?
+                  param_to_float (context, paramtype, param, i) : NAN;
+            }
+         kalman_predict (this);
+         kalman_update (this);
+
+         // States lane by lane, reusing measurement scratch space
+         for (l = 0; l < lanes; l++)
+            for (i = 0; i < this->n; i++)
+               this->FP[l * this->n + i] = this->x[i * lanes + l];
+         write_fv (context, linked_channels (context, id),
+                   this->n * lanes, this->FP);
+      }
+      break;
+
+   case read_rmcios:
+      if (this == NULL || this->x == NULL)
+         break;
+      {
+         int i, l;
+         for (l = 0; l < this->lanes; l++)
+            for (i = 0; i < this->n; i++)
+               return_float (context, returnv,
+                             this->x[i * this->lanes + l]);
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+void init_std_filter_channels (const struct context_rmcios *context)
+{
+   create_channel_str (context, "filter", (class_rmcios) filter_class_func,
+                       NULL);
+   create_channel_str (context, "median", (class_rmcios) median_class_func,
+                       NULL);
+   create_channel_str (context, "kalman", (class_rmcios) kalman_class_func,
+                       NULL);
+}
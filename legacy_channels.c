@@ -38,17 +38,269 @@ along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+
+#include "monotonic_time.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <time.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////
 // Commander for commandig linked channel with predefined string patterns //
 ////////////////////////////////////////////////////////////////////////////
+// Command template compiled to literal and parameter segments
+struct commander_segment
+{
+   int param;    // Parameter index. -1 for literal text.
+   int offset;   // Literal text position in the template
+   int length;
+};
+
+struct commander_template
+{
+   char *text;
+   struct commander_segment *segments;
+   int num_segments;
+};
+
 struct commander_data
 {
    int commanded_channel;
-   char write_command[40];
-   char read_command[40];
+   int templates;      // Commands contain $n placeholders
+   struct commander_template write_command;
+   struct commander_template read_command;
+
+   // Reused buffer for rendered commands
+   char *render;
+   int render_size;
+
+   // Latest reply of asynchronous read
+   int async;
+   char *reply;
+   int reply_size;
+#ifdef __linux__
+   const struct context_rmcios *context;
+   pthread_mutex_t lock;
+   pthread_cond_t requested;
+   pthread_t thread;
+   int thread_started;
+   int fetching;
+
+   // Held over each request/reply exchange with the commanded channel
+   // and while templates are changed. Recursive for reentrant replies.
+   pthread_mutex_t io_lock;
+#endif
 };
 
+void commander_io_lock (struct commander_data *this)
+{
+#ifdef __linux__
+   pthread_mutex_lock (&this->io_lock);
+#endif
+}
+
+void commander_io_unlock (struct commander_data *this)
+{
+#ifdef __linux__
+   pthread_mutex_unlock (&this->io_lock);
+#endif
+}
+
+// Compile template. With placeholders $1..$n are replaced by write/read
+// parameters and $$ is literal $. Without the whole text is literal.
+int commander_compile (struct commander_template *t, const char *text,
+                       int placeholders)
+{
+   int length = strlen (text);
+   int i, start;
+
+   free (t->text);
+   free (t->segments);
+   t->num_segments = 0;
+   t->text = malloc (length + 1);
+   // Worst case every character starts a segment
+   t->segments = malloc ((length + 1) * sizeof (struct commander_segment));
+   if (t->text == NULL || t->segments == NULL)
+   {
+      free (t->text);
+      free (t->segments);
+      t->text = NULL;
+      t->segments = NULL;
+      return -1;
+   }
+   memcpy (t->text, text, length + 1);
+
+   start = 0;
+   for (i = 0; i <= length; i++)
+   {
+      int placeholder = (placeholders && text[i] == '$'
+                         && (isdigit ((unsigned char) text[i + 1])
+                             || text[i + 1] == '$'));
+      if (i < length && !placeholder)
+         continue;
+
+      // Literal before placeholder or end
+      if (i > start)
+      {
+         t->segments[t->num_segments].param = -1;
+         t->segments[t->num_segments].offset = start;
+         t->segments[t->num_segments].length = i - start;
+         t->num_segments++;
+      }
+      if (i == length)
+         break;
+
+      if (text[i + 1] == '$')
+      {
+         // Escaped $ starts next literal
+         start = i + 1;
+         i++;
+      }
+      else
+      {
+         char *end;
+         int index = strtol (text + i + 1, &end, 10);
+         t->segments[t->num_segments].param = index - 1;
+         t->segments[t->num_segments].offset = 0;
+         t->segments[t->num_segments].length = 0;
+         t->num_segments++;
+         start = end - text;
+         i = start - 1;
+      }
+   }
+   return 0;
+}
+
+// Make room in the render buffer. Returns 0 on success.
+int commander_reserve (char **render, int *render_size, int size)
+{
+   char *grown;
+   int grown_size = *render_size ? *render_size : 64;
+   if (size <= *render_size)
+      return 0;
+   while (grown_size < size)
+      grown_size *= 2;
+   grown = realloc (*render, grown_size);
+   if (grown == NULL)
+      return -1;
+   *render = grown;
+   *render_size = grown_size;
+   return 0;
+}
+
+// Render template with parameters to the render buffer. Returns length.
+int commander_render (char **render, int *render_size,
+                      const struct context_rmcios *context,
+                      const struct commander_template *t,
+                      enum type_rmcios paramtype, int num_params,
+                      const union param_rmcios param)
+{
+   int length = 0;
+   int i;
+   for (i = 0; i < t->num_segments; i++)
+   {
+      const struct commander_segment *s = t->segments + i;
+      if (s->param < 0)
+      {
+         if (commander_reserve (render, render_size, length + s->length) != 0)
+            break;
+         memcpy (*render + length, t->text + s->offset, s->length);
+         length += s->length;
+      }
+      else if (s->param < num_params)
+      {
+         struct buffer_rmcios b;
+         int plen = param_buffer_alloc_size (context, paramtype, param,
+                                             s->param);
+         if (commander_reserve (render, render_size, length + plen) != 0)
+            break;
+         b = param_to_buffer (context, paramtype, param, s->param, plen,
+                              *render + length);
+         if (b.data != *render + length)
+            memmove (*render + length, b.data, b.length);
+         length += b.length;
+      }
+   }
+   return length;
+}
+
+// Send read command and store the reply. Used by the background thread
+// with its own buffers.
+void commander_fetch (struct commander_data *this,
+                      const struct context_rmcios *context,
+                      char **render, int *render_size,
+                      char **reply, int *reply_size)
+{
+   int length;
+   if (this->read_command.num_segments > 0)
+   {
+      length = commander_render (render, render_size, context,
+                                 &this->read_command, int_rmcios, 0,
+                                 (const union param_rmcios) 0);
+      write_buffer (context, this->commanded_channel, *render, length, 0);
+   }
+   if (*reply_size == 0)
+   {
+      *reply = malloc (64);
+      if (*reply == NULL)
+         return;
+      *reply_size = 64;
+      (*reply)[0] = 0;
+   }
+   length = read_str (context, this->commanded_channel, *reply, *reply_size);
+   if (length >= *reply_size)
+   {
+      // Reply was truncated. Grow for the following replies.
+      char *grown = realloc (*reply, length + 1);
+      if (grown != NULL)
+      {
+         *reply = grown;
+         *reply_size = length + 1;
+      }
+   }
+}
+
+#ifdef __linux__
+void *commander_thread (void *data)
+{
+   struct commander_data *this = data;
+   char *render = NULL;
+   int render_size = 0;
+   char *reply = NULL;
+   int reply_size = 0;
+
+   pthread_mutex_lock (&this->lock);
+   for (;;)
+   {
+      while (!this->fetching)
+         pthread_cond_wait (&this->requested, &this->lock);
+      pthread_mutex_unlock (&this->lock);
+
+      commander_io_lock (this);
+      commander_fetch (this, this->context, &render, &render_size,
+                       &reply, &reply_size);
+      commander_io_unlock (this);
+
+      // Publish the new reply by swapping buffers
+      pthread_mutex_lock (&this->lock);
+      {
+         char *previous = this->reply;
+         int previous_size = this->reply_size;
+         this->reply = reply;
+         this->reply_size = reply_size;
+         reply = previous;
+         reply_size = previous_size;
+      }
+      this->fetching = 0;
+   }
+   return NULL;
+}
+#endif
+
 void commander_class_func (struct commander_data *this,
                            const struct context_rmcios *context, int id,
                            enum function_rmcios function,
@@ -66,11 +318,17 @@ void commander_class_func (struct commander_data *this,
                      " interface\r\n"
                      " create commander newname\r\n"
                      " setup newname command_channel | write_command |"
-                     " read_command \r\n"
-                     " read newname #Write read_command to commanded_channel."
-                     " Read commanded channel data.\r\n"
-                     " write newname #Send commanded channel read data to "
-                     " linked channel.\r\n "
+                     " read_command | async | templates\r\n"
+                     "  -templates 1: commands may contain $1 $2... that"
+                     " are replaced with write/read parameters."
+                     " $$ for $.\r\n"
+                     "   0: commands are sent as is (default)\r\n"
+                     "  -async 1: read returns previous reply and"
+                     " fetches new one in background (linux)\r\n"
+                     " read newname | params... #Write read_command to"
+                     " commanded_channel. Read commanded channel data.\r\n"
+                     " write newname | params...#Send commanded channel"
+                     " read data to linked channel.\r\n "
                      "	#Write write_command to commanded_channel. \r\n"
                      " link newname channel #Set linked channel.\r\n");
       break;
@@ -82,44 +340,115 @@ void commander_class_func (struct commander_data *this,
       this = (struct commander_data *) 
              allocate_storage (context, sizeof (struct commander_data), 0); 
       if (this == NULL)
+      {
          printf ("Could not allocate memory for a commander!\n");
+         break;
+      }
       
       //default values :
-      this->write_command[0] = 0;
-      this->read_command[0] = 0;
+      memset (&this->write_command, 0, sizeof (this->write_command));
+      memset (&this->read_command, 0, sizeof (this->read_command));
       this->commanded_channel = 0;
+      this->templates = 0;
+      this->render = NULL;
+      this->render_size = 0;
+      this->async = 0;
+      this->reply = NULL;
+      this->reply_size = 0;
+#ifdef __linux__
+      this->context = context;
+      this->thread_started = 0;
+      this->fetching = 0;
+      pthread_mutex_init (&this->lock, NULL);
+      pthread_cond_init (&this->requested, NULL);
+      {
+         pthread_mutexattr_t attr;
+         pthread_mutexattr_init (&attr);
+         pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+         pthread_mutex_init (&this->io_lock, &attr);
+         pthread_mutexattr_destroy (&attr);
+      }
+#endif
       // create channel
       create_channel_param (context, paramtype, param, 0, 
                             (class_rmcios) commander_class_func, this);   
       break;
 
    case setup_rmcios:
-      // 0=commanded_channel | 1=write_command | 2=read_command 
+      // 0=commanded_channel | 1=write_command | 2=read_command | 3=async
+      // 4=templates
       if (this == NULL)
          break;
       if (num_params < 1)
          break;
+      // Background fetch must not see half changed setup
+      commander_io_lock (this);
       this->commanded_channel = param_to_int (context, paramtype, param, 0);
-      if (num_params < 2)
-         break;
-      param_to_string (context, paramtype, param, 1,
-                       sizeof (this->write_command), this->write_command);
-      if (num_params < 3)
+      this->templates = 0;
+      if (num_params > 4)
+         this->templates = param_to_int (context, paramtype, param, 4);
+      if (num_params > 1)
+      {
+         slen = param_string_alloc_size (context, paramtype, param, 1);
+         char command[slen];
+         param_to_string (context, paramtype, param, 1, slen, command);
+         commander_compile (&this->write_command, command,
+                            this->templates);
+      }
+      if (num_params > 2)
+      {
+         slen = param_string_alloc_size (context, paramtype, param, 2);
+         char command[slen];
+         param_to_string (context, paramtype, param, 2, slen, command);
+         commander_compile (&this->read_command, command,
+                            this->templates);
+      }
+      commander_io_unlock (this);
+      if (num_params < 4)
          break;
-      param_to_string (context, paramtype, param, 2,
-                       sizeof (this->read_command), this->read_command);
+      this->async = param_to_int (context, paramtype, param, 3);
+#ifdef __linux__
+      if (this->async && !this->thread_started)
+      {
+         if (pthread_create (&this->thread, NULL, commander_thread,
+                             this) == 0)
+            this->thread_started = 1;
+         else
+            this->async = 0;
+      }
+#else
+      this->async = 0;
+#endif
       break;
 
    case read_rmcios:
       if (this == NULL)
          break;
-      if (this->read_command[0] != 0)
+#ifdef __linux__
+      if (this->async && num_params < 1)
       {
-         write_str (context, this->commanded_channel, this->read_command, 0);
+         pthread_mutex_lock (&this->lock);
+         if (this->reply != NULL)
+            return_string (context, returnv, this->reply);
+         // Start fetching next reply
+         this->fetching = 1;
+         pthread_cond_signal (&this->requested);
+         pthread_mutex_unlock (&this->lock);
+         break;
+      }
+#endif
+      commander_io_lock (this);
+      if (this->read_command.num_segments > 0)
+      {
+         int length = commander_render (&this->render, &this->render_size,
+                                        context, &this->read_command,
+                                        paramtype, num_params, param);
+         write_buffer (context, this->commanded_channel, this->render,
+                       length, 0);
       }
       run_channel (context, this->commanded_channel, function,
                             paramtype, returnv, 0, param);
-
+      commander_io_unlock (this);
       break;
    case write_rmcios:
       if (this == NULL)
@@ -133,6 +462,8 @@ void commander_class_func (struct commander_data *this,
          .param.channel = linked_channels (context, id)
       };
 
+      commander_io_lock (this);
+
       // Send commanded channel read data to linked channel:
       run_channel (context, this->commanded_channel,
                             read_rmcios, buffer_rmcios,
@@ -140,21 +471,15 @@ void commander_class_func (struct commander_data *this,
                             (const union param_rmcios) 0);
 
       // Write the parameter printed write_command to commanded channel:
-      /*if (this->write_command[0] != 0)
+      if (this->write_command.num_segments > 0)
       {
-         if (paramtype == buffer_rmcios || paramtype == channel_rmcios)
-         {
-            print_param (context, this->write_command,
-                         channel_rmcios,
-                         (void *) this->commanded_channel, num_params, param);
-         }
-         else
-         {
-            print_param (context, this->write_command,
-                         channel_rmcios,
-                         (void *) this->commanded_channel, 0, NULL);
-         }
-      }*/
+         int length = commander_render (&this->render, &this->render_size,
+                                        context, &this->write_command,
+                                        paramtype, num_params, param);
+         write_buffer (context, this->commanded_channel, this->render,
+                       length, 0);
+      }
+      commander_io_unlock (this);
       break;
    }
 }
@@ -162,12 +487,416 @@ void commander_class_func (struct commander_data *this,
 ///////////////////////////////////////////////
 // branch input class
 ///////////////////////////////////////////////
+#ifdef __linux__
+// One parallel read or write of the branch members
+struct branch_call
+{
+   int refs;           // Caller and unfinished jobs
+   int pending;
+   int num_members;
+   enum function_rmcios function;
+   int num_params;
+   struct buffer_rmcios *params;
+   struct buffer_rmcios *results;
+   char *done;
+};
+
+struct branch_job
+{
+   struct branch_job *next;
+   struct branch_call *call;
+   int member;
+};
+
+struct branch_member_stats
+{
+   unsigned int count;
+   unsigned int timeouts;
+   double latency_sum;
+   double latency_max;
+   int result_size;
+};
+#endif
+
 struct branch_data
 {
    int num_linked;
    int *linked_channels;
+
+#ifdef __linux__
+   // Parallel mode. workers==0 runs members in sequence.
+   int workers;
+   int wait_count;     // Members to wait for. 0 for all.
+   float timeout;      // Seconds. 0 waits without limit.
+   int result_size;    // Initial result buffer size of each member
+   const struct context_rmcios *context;
+   pthread_t *threads;
+   int num_threads;
+   pthread_mutex_t lock;
+   pthread_cond_t job_ready;
+   pthread_cond_t job_done;
+   struct branch_job *jobs;
+   struct branch_job **jobs_tail;
+   struct branch_member_stats *stats;
+#endif
 };
 
+#ifdef __linux__
+void *branch_worker (void *data)
+{
+   struct branch_data *this = data;
+   pthread_mutex_lock (&this->lock);
+   for (;;)
+   {
+      struct branch_job *job;
+      struct branch_call *call;
+      const struct context_rmcios *context;
+      struct combo_rmcios returnv;
+      double start, latency;
+      int channel;
+
+      while (this->jobs == NULL)
+      {
+         // Extra workers exit when the worker count has been lowered
+         if (this->num_threads > this->workers)
+         {
+            this->num_threads--;
+            pthread_mutex_unlock (&this->lock);
+            return NULL;
+         }
+         pthread_cond_wait (&this->job_ready, &this->lock);
+      }
+      job = this->jobs;
+      this->jobs = job->next;
+      if (this->jobs == NULL)
+         this->jobs_tail = &this->jobs;
+      call = job->call;
+      channel = job->member < this->num_linked ?
+         this->linked_channels[job->member] : 0;
+      context = this->context;
+      pthread_mutex_unlock (&this->lock);
+
+      returnv.paramtype = buffer_rmcios;
+      returnv.num_params = 1;
+      returnv.param.bv = call->results + job->member;
+      start = monotonic_time ();
+      run_channel (context, channel, call->function, buffer_rmcios,
+                   &returnv, call->num_params,
+                   (const union param_rmcios) call->params);
+      latency = monotonic_time () - start;
+
+      pthread_mutex_lock (&this->lock);
+      if (job->member < this->num_linked && this->stats != NULL)
+      {
+         struct branch_member_stats *stats = this->stats + job->member;
+         stats->count++;
+         stats->latency_sum += latency;
+         if (latency > stats->latency_max)
+            stats->latency_max = latency;
+         if (call->results[job->member].required_size > stats->result_size)
+            stats->result_size = call->results[job->member].required_size;
+      }
+      call->done[job->member] = 1;
+      call->pending--;
+      pthread_cond_broadcast (&this->job_done);
+      if (--call->refs == 0)
+         free (call);
+      free (job);
+   }
+   return NULL;
+}
+
+// Start workers up to the configured amount
+void branch_start_workers (struct branch_data *this)
+{
+   pthread_t *threads;
+   if (this->num_threads >= this->workers)
+      return;
+   threads = realloc (this->threads, this->workers * sizeof (pthread_t));
+   if (threads == NULL)
+      return;
+   this->threads = threads;
+   while (this->num_threads < this->workers)
+   {
+      if (pthread_create (this->threads + this->num_threads, NULL,
+                          branch_worker, this) != 0)
+         break;
+      pthread_detach (this->threads[this->num_threads]);
+      this->num_threads++;
+   }
+}
+
+// Run members in worker threads. Results are returned in member order.
+// Returns 0 when parallel mode is not available and nothing was run.
+int branch_parallel (struct branch_data *this,
+                     const struct context_rmcios *context,
+                     enum function_rmcios function,
+                     enum type_rmcios paramtype,
+                     struct combo_rmcios *returnv,
+                     int num_params, const union param_rmcios param)
+{
+   struct branch_call *call;
+   size_t size;
+   char *data;
+   int *result_sizes;
+   int num_members;
+   int wait_count;
+   int i;
+
+   // Members and their result sizes at the time of the call. Workers of
+   // earlier calls and setup may change them while the call is built.
+   pthread_mutex_lock (&this->lock);
+   num_members = this->num_linked;
+   if (this->num_threads <= 0 || this->workers <= 0 || num_members <= 0
+       || this->stats == NULL)
+   {
+      pthread_mutex_unlock (&this->lock);
+      return 0;
+   }
+   result_sizes = malloc (num_members * sizeof (int));
+   if (result_sizes == NULL)
+   {
+      pthread_mutex_unlock (&this->lock);
+      return 0;
+   }
+   for (i = 0; i < num_members; i++)
+      result_sizes[i] = this->stats[i].result_size;
+   pthread_mutex_unlock (&this->lock);
+
+   // Single block for call, copied parameters and member results
+   size = sizeof (*call)
+      + num_params * sizeof (struct buffer_rmcios)
+      + num_members * (sizeof (struct buffer_rmcios) + 1);
+   for (i = 0; i < num_params; i++)
+      size += param_buffer_alloc_size (context, paramtype, param, i);
+   for (i = 0; i < num_members; i++)
+      size += result_sizes[i];
+   call = malloc (size);
+   if (call == NULL)
+   {
+      free (result_sizes);
+      return 0;
+   }
+
+   call->function = function;
+   call->num_params = num_params;
+   call->num_members = num_members;
+   call->params = (struct buffer_rmcios *) (call + 1);
+   call->results = call->params + num_params;
+   call->done = (char *) (call->results + num_members);
+   data = call->done + num_members;
+   for (i = 0; i < num_params; i++)
+   {
+      int plen = param_buffer_alloc_size (context, paramtype, param, i);
+      struct buffer_rmcios b;
+      b = param_to_buffer (context, paramtype, param, i, plen, data);
+      if (b.data != data)
+         memmove (data, b.data, b.length);
+      call->params[i].data = data;
+      call->params[i].length = b.length;
+      call->params[i].size = b.length;
+      call->params[i].required_size = b.length;
+      call->params[i].trailing_size = 0;
+      data += plen;
+   }
+   for (i = 0; i < num_members; i++)
+   {
+      call->results[i].data = data;
+      call->results[i].length = 0;
+      call->results[i].size = result_sizes[i];
+      call->results[i].required_size = 0;
+      call->results[i].trailing_size = 0;
+      data += result_sizes[i];
+      call->done[i] = 0;
+   }
+   free (result_sizes);
+
+   pthread_mutex_lock (&this->lock);
+   call->refs = 1;
+   call->pending = 0;
+   for (i = 0; i < num_members; i++)
+   {
+      struct branch_job *job = malloc (sizeof (*job));
+      if (job == NULL)
+      {
+         // Not dispatched. Counts as finished without result.
+         call->done[i] = 1;
+         continue;
+      }
+      job->call = call;
+      job->member = i;
+      job->next = NULL;
+      *this->jobs_tail = job;
+      this->jobs_tail = &job->next;
+      call->refs++;
+      call->pending++;
+   }
+   pthread_cond_broadcast (&this->job_ready);
+
+   // Wait for all or the first wait_count members
+   wait_count = this->wait_count;
+   if (wait_count <= 0 || wait_count > num_members)
+      wait_count = num_members;
+   {
+      struct timespec deadline;
+      double t = this->timeout;
+      clock_gettime (CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += (time_t) t;
+      deadline.tv_nsec += (t - (time_t) t) * 1e9;
+      if (deadline.tv_nsec >= 1000000000)
+      {
+         deadline.tv_sec++;
+         deadline.tv_nsec -= 1000000000;
+      }
+      while (num_members - call->pending < wait_count)
+      {
+         if (t <= 0)
+            pthread_cond_wait (&this->job_done, &this->lock);
+         else if (pthread_cond_timedwait (&this->job_done, &this->lock,
+                                          &deadline) != 0)
+            break;
+      }
+   }
+
+   // Results in member order. Unfinished members give an empty field.
+   for (i = 0; i < num_members; i++)
+   {
+      if (!call->done[i])
+      {
+         if (this->timeout > 0 && wait_count == num_members
+             && this->stats != NULL && i < this->num_linked)
+            this->stats[i].timeouts++;
+         if (returnv != NULL)
+            return_string (context, returnv, " ");
+         continue;
+      }
+      if (returnv != NULL)
+      {
+         int length = call->results[i].length;
+         if (length > call->results[i].size)
+            length = call->results[i].size;
+         return_buffer (context, returnv, call->results[i].data, length);
+         return_string (context, returnv, " ");
+      }
+   }
+   if (--call->refs == 0)
+      free (call);
+   pthread_mutex_unlock (&this->lock);
+   return 1;
+}
+
+void branch_parallel_subchan_func (struct branch_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   int i;
+   if (this == NULL)
+      return;
+   switch (function)
+   {
+   case write_rmcios:
+      if (num_params < 1)
+         break;
+      pthread_mutex_lock (&this->lock);
+      this->workers = param_to_int (context, paramtype, param, 0);
+      if (num_params >= 2)
+         this->wait_count = param_to_int (context, paramtype, param, 1);
+      if (num_params >= 3)
+         this->timeout = param_to_float (context, paramtype, param, 2);
+      if (num_params >= 4)
+      {
+         this->result_size = param_to_int (context, paramtype, param, 3);
+         if (this->result_size < 1)
+            this->result_size = 1;
+         for (i = 0; this->stats != NULL && i < this->num_linked; i++)
+         {
+            if (this->stats[i].result_size < this->result_size)
+               this->stats[i].result_size = this->result_size;
+         }
+      }
+      this->context = context;
+      branch_start_workers (this);
+      // Wake idle workers so that extra ones exit
+      pthread_cond_broadcast (&this->job_ready);
+      pthread_mutex_unlock (&this->lock);
+      break;
+   case read_rmcios:
+      // Member statistics: count mean_latency max_latency timeouts
+      pthread_mutex_lock (&this->lock);
+      for (i = 0; this->stats != NULL && i < this->num_linked; i++)
+      {
+         struct branch_member_stats *stats = this->stats + i;
+         return_int (context, returnv, stats->count);
+         return_float (context, returnv, stats->count > 0 ?
+                       stats->latency_sum / stats->count : 0);
+         return_float (context, returnv, stats->latency_max);
+         return_int (context, returnv, stats->timeouts);
+      }
+      pthread_mutex_unlock (&this->lock);
+      break;
+   default:
+      break;
+   }
+}
+#endif
+
+// Typed read of all members. One value per member without text.
+// Members that do not return a value give NaN.
+void branch_fv_subchan_func (struct branch_data *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   int i;
+   if (this == NULL || function != read_rmcios)
+      return;
+   for (i = 0; i < this->num_linked; i++)
+   {
+      float value = NAN;
+      struct combo_rmcios member_returnv =
+      {
+         .paramtype = float_rmcios,
+         .num_params = 1,
+         .param.fv = &value
+      };
+      run_channel (context, this->linked_channels[i], read_rmcios,
+                   paramtype, &member_returnv, num_params, param);
+      return_float (context, returnv, value);
+   }
+}
+
+// Members that do not return a value give INT_MIN.
+void branch_iv_subchan_func (struct branch_data *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   int i;
+   if (this == NULL || function != read_rmcios)
+      return;
+   for (i = 0; i < this->num_linked; i++)
+   {
+      int value = INT_MIN;
+      struct combo_rmcios member_returnv =
+      {
+         .paramtype = int_rmcios,
+         .num_params = 1,
+         .param.iv = &value
+      };
+      run_channel (context, this->linked_channels[i], read_rmcios,
+                   paramtype, &member_returnv, num_params, param);
+      return_int (context, returnv, value);
+   }
+}
+
 void branch_class_func (struct branch_data *this,
                         const struct context_rmcios *context, int id,
                         enum function_rmcios function,
@@ -190,7 +919,27 @@ void branch_class_func (struct branch_data *this,
                      " read newname channel \r\n"
                      "  #read all configured channels\n"
                      " link newname channel \r\n"
-                     "  #link all configured channels to channel\r\n");
+                     "  #link all configured channels to channel\r\n"
+                     " write newname_parallel workers | wait_count timeout"
+                     " result_size (linux)\r\n"
+                     "  #run channels in worker threads."
+                     " Channels must be thread safe.\r\n"
+                     "  #workers 0: run in sequence (default)\r\n"
+                     "  #wait_count: return after first n. 0 for all\r\n"
+                     "  #timeout: return after seconds. 0 for no limit\r\n"
+                     "  #results are returned in channel order."
+                     " Empty for unfinished channels\r\n"
+                     "  #result_size: result buffer bytes per channel"
+                     " (64). Longer result is truncated once,\r\n"
+                     "   the buffer then grows to fit it\r\n"
+                     " read newname_parallel \r\n"
+                     "  #for each channel: count mean_latency"
+                     " max_latency timeouts\r\n"
+                     " read newname_fv \r\n"
+                     "  #read channels as float vector. NaN on failure\r\n"
+                     " read newname_iv \r\n"
+                     "  #read channels as int vector."
+                     " INT_MIN on failure\r\n");
       break;
 
    case create_rmcios:
@@ -204,38 +953,92 @@ void branch_class_func (struct branch_data *this,
 
       //default values :
       this->num_linked = 0;
+#ifdef __linux__
+      this->workers = 0;
+      this->wait_count = 0;
+      this->timeout = 0;
+      this->result_size = 64;
+      this->threads = NULL;
+      this->num_threads = 0;
+      this->jobs = NULL;
+      this->jobs_tail = &this->jobs;
+      this->stats = NULL;
+      pthread_mutex_init (&this->lock, NULL);
+      {
+         pthread_condattr_t attr;
+         pthread_condattr_init (&attr);
+         pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+         pthread_cond_init (&this->job_done, &attr);
+         pthread_condattr_destroy (&attr);
+      }
+      pthread_cond_init (&this->job_ready, NULL);
+#endif
 
       // create channel
-      create_channel_param (context, paramtype, param, 0, 
-                            (class_rmcios) branch_class_func, this); 
+      id = create_channel_param (context, paramtype, param, 0, 
+                                 (class_rmcios) branch_class_func, this); 
+      create_subchannel_str (context, id, "_fv",
+                             (class_rmcios) branch_fv_subchan_func, this);
+      create_subchannel_str (context, id, "_iv",
+                             (class_rmcios) branch_iv_subchan_func, this);
+#ifdef __linux__
+      create_subchannel_str (context, id, "_parallel",
+                             (class_rmcios) branch_parallel_subchan_func,
+                             this);
+#endif
       break;
 
    case setup_rmcios:
       if (this == NULL)
          break;
+#ifdef __linux__
+      pthread_mutex_lock (&this->lock);
+#endif
       if (num_params < 1)
       { // no linked channels
          if (this->num_linked != 0)
             free (this->linked_channels);
          this->num_linked = 0;
-         break;
       }
-      if (this->num_linked != 0)
-         free (this->linked_channels);
-      this->num_linked = num_params;
-      this->linked_channels = (int *) malloc (sizeof (int) * this->num_linked);
-
-      for (i = 0; i < this->num_linked; i++)
-      { 
-         // attach linked channels
-         this->linked_channels[i] = param_to_int (context, paramtype, param, i);
+      else
+      {
+         if (this->num_linked != 0)
+            free (this->linked_channels);
+         this->num_linked = num_params;
+         this->linked_channels =
+            (int *) malloc (sizeof (int) * this->num_linked);
 
+         for (i = 0; i < this->num_linked; i++)
+         { 
+            // attach linked channels
+            this->linked_channels[i] =
+               param_to_int (context, paramtype, param, i);
+         }
       }
+#ifdef __linux__
+      free (this->stats);
+      this->stats = calloc (this->num_linked + 1, sizeof (*this->stats));
+      if (this->stats == NULL)
+      {
+         info (context, context->errors,
+               "branch: Could not allocate parallel mode."
+               " Running in sequence.\r\n");
+         this->workers = 0;
+      }
+      for (i = 0; this->stats != NULL && i < this->num_linked; i++)
+         this->stats[i].result_size = this->result_size;
+      pthread_mutex_unlock (&this->lock);
+#endif
       break;
    case write_rmcios:
    case read_rmcios:
       if (this == NULL)
          break;
+#ifdef __linux__
+      if (branch_parallel (this, context, function, paramtype, returnv,
+                           num_params, param))
+         break;
+#endif
       for (i = 0; i < this->num_linked; i++)
       { // execute linked channels
          run_channel (context, this->linked_channels[i],
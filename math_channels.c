@@ -36,14 +36,21 @@ along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
 #include "RMCIOS-functions.h"
 #include <math.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "vector_kernels.h"
+#include "monotonic_time.h"
 
 ////////////////////////////////////////////////
 // scaling channels:
 ////////////////////////////////////////////////
-float sqrt_func (float a, float b)
-{
-   return sqrt (a);
-}
+// Inlining of the operation into each operator class function
+#ifdef __GNUC__
+#define STD_OPERATOR_INLINE static inline __attribute__ ((always_inline))
+#else
+#define STD_OPERATOR_INLINE static inline
+#endif
 
 struct oper
 {
@@ -51,8 +58,62 @@ struct oper
    float valueB;
    int valueA_channel;
    int valueB_channel;
+   float valueC;
+
+   // Lazy mode: result is cached until an input signals a change
+   int lazy;
+   int dirty;
+   float result;
+   int dirty_channel;
 };
 
+// Signal dependents linked to the _dirty subchannel (empty write)
+void std_operator_notify (struct oper *this,
+                          const struct context_rmcios *context)
+{
+   run_channel (context, linked_channels (context, this->dirty_channel),
+                write_rmcios, int_rmcios, 0, 0, (const union param_rmcios) 0);
+}
+
+void std_operator_dirty_subchan_func (struct oper *this,
+                                      const struct context_rmcios *context,
+                                      int id, enum function_rmcios function,
+                                      enum type_rmcios paramtype,
+                                      struct combo_rmcios *returnv,
+                                      int num_params,
+                                      const union param_rmcios param)
+{
+   switch (function)
+   {
+   case write_rmcios:
+      // Input changed. Invalidate once and pass on to dependents.
+      if (!this->dirty)
+      {
+         this->dirty = 1;
+         std_operator_notify (this, context);
+      }
+      break;
+   case read_rmcios:
+      return_int (context, returnv, this->dirty);
+      break;
+   default:
+      break;
+   }
+}
+
+void std_operator_create_lazy (struct oper *this,
+                               const struct context_rmcios *context, int id)
+{
+   this->lazy = 0;
+   this->dirty = 1;
+   this->result = 0;
+   this->dirty_channel =
+      create_subchannel_str (context, id, "_dirty",
+                             (class_rmcios) std_operator_dirty_subchan_func,
+                             this);
+}
+
+STD_OPERATOR_INLINE
 void generic_std_operator_class_func (struct oper *this,
                                   const struct context_rmcios *context,
                                   int id, enum function_rmcios function,
@@ -60,7 +121,8 @@ void generic_std_operator_class_func (struct oper *this,
                                   struct combo_rmcios *returnv,
                                   int num_params,
                                   const union param_rmcios param,
-                                  float (*opfunc) (float, float))
+                                  float (*opfunc) (float, float, float),
+                                  enum vector_op vop)
 {
    switch (function)
    {
@@ -69,6 +131,23 @@ void generic_std_operator_class_func (struct oper *this,
          break;
       if (num_params < 1)
          break;
+      if (num_params == 2)
+      {
+         char key[8];
+         param_to_string (context, paramtype, param, 0, sizeof (key), key);
+         if (strcmp (key, "lazy") == 0)
+         {
+            this->lazy = param_to_int (context, paramtype, param, 1);
+            this->dirty = 1;
+            break;
+         }
+         if (strcmp (key, "C") == 0)
+         {
+            this->valueC = param_to_float (context, paramtype, param, 1);
+            this->dirty = 1;
+            break;
+         }
+      }
       this->valueB = param_to_float (context, paramtype, param, 0);
       if (num_params < 2)
          break;
@@ -76,6 +155,13 @@ void generic_std_operator_class_func (struct oper *this,
       if (num_params < 3)
          break;
       this->valueB_channel = param_to_int (context, paramtype, param, 2);
+      if (num_params < 4)
+         break;
+      this->valueC = param_to_float (context, paramtype, param, 3);
+      if (num_params < 5)
+         break;
+      this->lazy = param_to_int (context, paramtype, param, 4);
+      this->dirty = 1;
       break;
 
    case write_rmcios:
@@ -87,34 +173,599 @@ void generic_std_operator_class_func (struct oper *this,
       if (this->valueB_channel != 0)
          // update B from channel
          this->valueB = read_f (context, this->valueB_channel); 
+      if (num_params > 1)
+      {
+         // Vector of A values. Result is sent as one vector.
+         float values[paramtype == float_rmcios ? 1 : num_params];
+         float result[num_params];
+         const float *a = param.fv;
+         int i;
+         if (paramtype != float_rmcios)
+         {
+            for (i = 0; i < num_params; i++)
+               values[i] = param_to_float (context, paramtype, param, i);
+            a = values;
+         }
+         if (vop != vector_op_none)
+            vector_apply (vop, a, this->valueB, this->valueC, result,
+                          num_params);
+         else
+         {
+            for (i = 0; i < num_params; i++)
+               result[i] = opfunc (a[i], this->valueB, this->valueC);
+         }
+         this->valueA = a[num_params - 1];
+         this->result = result[num_params - 1];
+         if (this->lazy)
+         {
+            this->dirty = 0;
+            std_operator_notify (this, context);
+         }
+         write_fv (context, linked_channels (context, id), num_params,
+                   result);
+         break;
+      }
       if (num_params >= 1)
          this->valueA = param_to_float (context, paramtype, param, 0);
-      write_f (context, linked_channels (context, id),
-               opfunc (this->valueA, this->valueB));
+      this->result = opfunc (this->valueA, this->valueB, this->valueC);
+      if (this->lazy)
+      {
+         this->dirty = 0;
+         std_operator_notify (this, context);
+      }
+      write_f (context, linked_channels (context, id), this->result);
       break;
    case read_rmcios:
       if (this == NULL)
          break;
+      if (this->lazy && !this->dirty)
+      {
+         // Inputs unchanged since last calculation
+         return_float (context, returnv, this->result);
+         break;
+      }
       if (this->valueA_channel != 0)
          // update A from channel
          this->valueA = read_f (context, this->valueA_channel); 
       if (this->valueB_channel != 0)
          // update B from channel
          this->valueB = read_f (context, this->valueB_channel); 
-      return_float (context, returnv,
-                    opfunc (this->valueA, this->valueB));
+      this->result = opfunc (this->valueA, this->valueB, this->valueC);
+      this->dirty = 0;
+      return_float (context, returnv, this->result);
       break;
    default:
       break;
    }
 }
 
+// Define operator channel NAME calculating EXPRESSION of a, b and c.
+// The expression is compiled into the class function.
+// Vector writes use VECTOR_OP kernel, or EXPRESSION per element when none.
+#define STD_OPERATOR(NAME, EXPRESSION, VECTOR_OP, HELP, \
+                     B_DEFAULT, C_DEFAULT) \
+STD_OPERATOR_INLINE float NAME##_op (float a, float b, float c) \
+{ \
+   return EXPRESSION; \
+} \
+void NAME##_class_func (struct oper *this, \
+                        const struct context_rmcios *context, \
+                        int id, enum function_rmcios function, \
+                        enum type_rmcios paramtype, \
+                        struct combo_rmcios *returnv, \
+                        int num_params, const union param_rmcios param) \
+{ \
+   switch (function) \
+   { \
+   case help_rmcios: \
+      return_string (context, returnv, HELP \
+                     " write newname A #calculate result with A\r\n" \
+                     " write newname A0 A1 A2... #calculate vector of" \
+                     " results. Sent as one vector\r\n" \
+                     " read newname #read result\r\n" \
+                     " link newname channel #link result to channel\r\n" \
+                     " write newname_dirty #signal input change\r\n" \
+                     " link newname_dirty dependent_dirty" \
+                     " #pass change signal on\r\n"); \
+      break; \
+   case create_rmcios: \
+      if (num_params < 1) \
+         break; \
+      this = (struct oper *) \
+             allocate_storage (context, sizeof (struct oper), 0); \
+      if (this == NULL) \
+         break; \
+      this->valueA = 1; \
+      this->valueB = B_DEFAULT; \
+      this->valueC = C_DEFAULT; \
+      this->valueA_channel = 0; \
+      this->valueB_channel = 0; \
+      id = create_channel_param (context, paramtype, param, 0, \
+                                 (class_rmcios) NAME##_class_func, this); \
+      std_operator_create_lazy (this, context, id); \
+      break; \
+   default: \
+      break; \
+   } \
+   generic_std_operator_class_func (this, context, id, function, paramtype, \
+                                    returnv, num_params, param, NAME##_op, \
+                                    VECTOR_OP); \
+}
+
 ///////////////////////////////////////////////
 //! Channel for square root operation
 ///////////////////////////////////////////////
-void sqrt_class_func (struct oper *this, struct context_rmcios *context,
-                      int id, enum function_rmcios function,
-                      enum type_rmcios paramtype, 
+STD_OPERATOR (sqrt, sqrt (a), vector_op_sqrt,
+              "help for sqrt square root channel:\r\n"
+              " create sqrt newname\r\n"
+              " write newname X # calculate result=sqrt(X) \r\n", 1, 0)
+
+///////////////////////////////////////////////
+//! Scalar operator channels
+///////////////////////////////////////////////
+#define STD_OPERATOR_SETUP_HELP \
+   " setup newname B | A_channel B_channel C lazy\r\n" \
+   "  -A_channel B_channel: read A and B from channels (0 for none)\r\n" \
+   " setup newname C value\r\n" \
+   "  -set C alone (clamp upper limit, scale offset)\r\n" \
+   " setup newname lazy 0|1\r\n" \
+   "  -lazy 1: cache result until newname_dirty is written." \
+   " Link input channels to newname_dirty\r\n"
+
+STD_OPERATOR (add, a + b, vector_op_add,
+              "add channel: result=A+B\r\n"
+              " create add newname\r\n" STD_OPERATOR_SETUP_HELP, 0, 0)
+STD_OPERATOR (sub, a - b, vector_op_sub,
+              "sub channel: result=A-B\r\n"
+              " create sub newname\r\n" STD_OPERATOR_SETUP_HELP, 0, 0)
+STD_OPERATOR (mul, a * b, vector_op_mul,
+              "mul channel: result=A*B\r\n"
+              " create mul newname\r\n" STD_OPERATOR_SETUP_HELP, 1, 0)
+STD_OPERATOR (div, a / b, vector_op_div,
+              "div channel: result=A/B\r\n"
+              " create div newname\r\n" STD_OPERATOR_SETUP_HELP, 1, 0)
+STD_OPERATOR (pow, powf (a, b), vector_op_none,
+              "pow channel: result=A^B\r\n"
+              " create pow newname\r\n" STD_OPERATOR_SETUP_HELP, 1, 0)
+STD_OPERATOR (min, a < b ? a : b, vector_op_min,
+              "min channel: result=min(A,B)\r\n"
+              " create min newname\r\n" STD_OPERATOR_SETUP_HELP, 0, 0)
+STD_OPERATOR (max, a > b ? a : b, vector_op_max,
+              "max channel: result=max(A,B)\r\n"
+              " create max newname\r\n" STD_OPERATOR_SETUP_HELP, 0, 0)
+STD_OPERATOR (log, logf (a) / logf (b), vector_op_none,
+              "log channel: result=log(A) in base B\r\n"
+              " create log newname\r\n" STD_OPERATOR_SETUP_HELP
+              "  -B default e (natural logarithm)\r\n", 2.718281828459045, 0)
+STD_OPERATOR (exp, powf (b, a), vector_op_none,
+              "exp channel: result=B^A\r\n"
+              " create exp newname\r\n" STD_OPERATOR_SETUP_HELP
+              "  -B default e\r\n", 2.718281828459045, 0)
+STD_OPERATOR (abs, fabsf (a), vector_op_abs,
+              "abs channel: result=|A|\r\n"
+              " create abs newname\r\n", 0, 0)
+STD_OPERATOR (clamp, fminf (fmaxf (a, b), c), vector_op_clamp,
+              "clamp channel: result=A limited to range B...C\r\n"
+              " create clamp newname\r\n" STD_OPERATOR_SETUP_HELP, 0, 1)
+STD_OPERATOR (scale, a * b + c, vector_op_scale,
+              "scale channel: result=A*B+C (scale and offset)\r\n"
+              " create scale newname\r\n" STD_OPERATOR_SETUP_HELP, 1, 0)
+
+///////////////////////////////////////////////
+//! Compiled arithmetic expression channel
+///////////////////////////////////////////////
+// Ordered by number of operands: loads, binary operators, unary operators
+enum expr_opcode
+{
+   expr_const, expr_input, expr_param,
+   expr_add, expr_sub, expr_mul, expr_div, expr_pow, expr_min, expr_max,
+   expr_neg, expr_sqrt, expr_exp, expr_log, expr_log10, expr_sin, expr_cos,
+   expr_tan, expr_abs
+};
+
+#define expr_is_load(op) ((op) <= expr_param)
+#define expr_is_binary(op) ((op) >= expr_add && (op) <= expr_max)
+
+struct expr_instruction
+{
+   enum expr_opcode op;
+   int index;          // Input or parameter index
+   float value;        // Constant value
+};
+
+#define EXPR_MAX_INPUTS 16
+
+struct expr_data
+{
+   struct expr_instruction *program;
+   int length;
+   int capacity;
+   int stack_size;
+
+   // Channels read once per evaluation
+   int inputs[EXPR_MAX_INPUTS];
+   int num_inputs;
+   float result;
+};
+
+// Parser state used only at setup
+struct expr_parser
+{
+   struct expr_data *expr;
+   const struct context_rmcios *context;
+   const char *s;
+   int depth;
+   int error;
+};
+
+struct expr_function
+{
+   const char *name;
+   enum expr_opcode op;
+   int args;
+};
+
+static const struct expr_function expr_functions[] = {
+   {"sqrt", expr_sqrt, 1}, {"exp", expr_exp, 1}, {"log", expr_log, 1},
+   {"log10", expr_log10, 1}, {"sin", expr_sin, 1}, {"cos", expr_cos, 1},
+   {"tan", expr_tan, 1}, {"abs", expr_abs, 1}, {"pow", expr_pow, 2},
+   {"min", expr_min, 2}, {"max", expr_max, 2}, {NULL, expr_const, 0}
+};
+
+float expr_apply (enum expr_opcode op, float a, float b)
+{
+   switch (op)
+   {
+   case expr_add:
+      return a + b;
+   case expr_sub:
+      return a - b;
+   case expr_mul:
+      return a * b;
+   case expr_div:
+      return a / b;
+   case expr_pow:
+      return pow (a, b);
+   case expr_min:
+      return a < b ? a : b;
+   case expr_max:
+      return a > b ? a : b;
+   case expr_neg:
+      return -a;
+   case expr_sqrt:
+      return sqrt (a);
+   case expr_exp:
+      return exp (a);
+   case expr_log:
+      return log (a);
+   case expr_log10:
+      return log10 (a);
+   case expr_sin:
+      return sin (a);
+   case expr_cos:
+      return cos (a);
+   case expr_tan:
+      return tan (a);
+   case expr_abs:
+      return fabs (a);
+   default:
+      return NAN;
+   }
+}
+
+void expr_emit (struct expr_parser *p, enum expr_opcode op, int index,
+                float value)
+{
+   struct expr_data *x = p->expr;
+   struct expr_instruction *in;
+   if (p->error)
+      return;
+   if (x->length == x->capacity)
+   {
+      int capacity = x->capacity ? x->capacity * 2 : 16;
+      struct expr_instruction *program =
+         realloc (x->program, capacity * sizeof (*program));
+      if (program == NULL)
+      {
+         p->error = 1;
+         return;
+      }
+      x->program = program;
+      x->capacity = capacity;
+   }
+   in = x->program + x->length;
+
+   // Constant folding: operate directly on constant operands
+   if (expr_is_binary (op) && x->length >= 2 
+       && in[-1].op == expr_const && in[-2].op == expr_const)
+   {
+      in[-2].value = expr_apply (op, in[-2].value, in[-1].value);
+      x->length--;
+      p->depth--;
+      return;
+   }
+   if (!expr_is_load (op) && !expr_is_binary (op) 
+       && x->length >= 1 && in[-1].op == expr_const)
+   {
+      in[-1].value = expr_apply (op, in[-1].value, 0);
+      return;
+   }
+
+   in->op = op;
+   in->index = index;
+   in->value = value;
+   x->length++;
+
+   // Track evaluation stack depth
+   if (expr_is_load (op))
+      p->depth++;
+   else if (expr_is_binary (op))
+      p->depth--;
+   if (p->depth > x->stack_size)
+      x->stack_size = p->depth;
+}
+
+void expr_skip_space (struct expr_parser *p)
+{
+   while (isspace ((unsigned char) *p->s))
+      p->s++;
+}
+
+void expr_parse_sum (struct expr_parser *p);
+void expr_parse_power (struct expr_parser *p);
+
+// primary: number | $n | name | function(args) | (sum) | -power
+void expr_parse_primary (struct expr_parser *p)
+{
+   expr_skip_space (p);
+   if (*p->s == '(')
+   {
+      p->s++;
+      expr_parse_sum (p);
+      expr_skip_space (p);
+      if (*p->s != ')')
+         p->error = 1;
+      else
+         p->s++;
+   }
+   else if (*p->s == '-')
+   {
+      // Unary minus binds weaker than ^ : -2^2 = -4
+      p->s++;
+      expr_parse_power (p);
+      expr_emit (p, expr_neg, 0, 0);
+   }
+   else if (*p->s == '+')
+   {
+      p->s++;
+      expr_parse_power (p);
+   }
+   else if (*p->s == '$')
+   {
+      char *end;
+      int index = strtol (p->s + 1, &end, 10);
+      if (end == p->s + 1 || index < 1)
+         p->error = 1;
+      p->s = end;
+      expr_emit (p, expr_param, index - 1, 0);
+   }
+   else if (isdigit ((unsigned char) *p->s) || *p->s == '.')
+   {
+      char *end;
+      float value = strtod (p->s, &end);
+      p->s = end;
+      expr_emit (p, expr_const, 0, value);
+   }
+   else if (isalpha ((unsigned char) *p->s) || *p->s == '_')
+   {
+      const char *start = p->s;
+      int length;
+      int i;
+      while (isalnum ((unsigned char) *p->s) || *p->s == '_')
+         p->s++;
+      length = p->s - start;
+      expr_skip_space (p);
+      if (*p->s == '(')
+      {
+         // Function call
+         for (i = 0; expr_functions[i].name != NULL; i++)
+         {
+            if (strlen (expr_functions[i].name) == length
+                && strncmp (expr_functions[i].name, start, length) == 0)
+               break;
+         }
+         if (expr_functions[i].name == NULL)
+         {
+            p->error = 1;
+            return;
+         }
+         p->s++;
+         expr_parse_sum (p);
+         if (expr_functions[i].args == 2)
+         {
+            expr_skip_space (p);
+            if (*p->s != ',')
+            {
+               p->error = 1;
+               return;
+            }
+            p->s++;
+            expr_parse_sum (p);
+         }
+         expr_skip_space (p);
+         if (*p->s != ')')
+         {
+            p->error = 1;
+            return;
+         }
+         p->s++;
+         expr_emit (p, expr_functions[i].op, 0, 0);
+      }
+      else if (length == 2 && strncmp (start, "pi", 2) == 0)
+      {
+         expr_emit (p, expr_const, 0, 3.14159265358979);
+      }
+      else
+      {
+         // Input channel
+         struct expr_data *x = p->expr;
+         char name[length + 1];
+         int channel;
+         memcpy (name, start, length);
+         name[length] = 0;
+         channel = channel_enum (p->context, name);
+         if (channel == 0)
+         {
+            p->error = 1;
+            return;
+         }
+         for (i = 0; i < x->num_inputs; i++)
+         {
+            if (x->inputs[i] == channel)
+               break;
+         }
+         if (i == x->num_inputs)
+         {
+            if (x->num_inputs == EXPR_MAX_INPUTS)
+            {
+               p->error = 1;
+               return;
+            }
+            x->inputs[x->num_inputs++] = channel;
+         }
+         expr_emit (p, expr_input, i, 0);
+      }
+   }
+   else
+      p->error = 1;
+}
+
+// power: primary ^ power (right associative)
+void expr_parse_power (struct expr_parser *p)
+{
+   expr_parse_primary (p);
+   expr_skip_space (p);
+   if (*p->s == '^')
+   {
+      p->s++;
+      expr_parse_power (p);
+      expr_emit (p, expr_pow, 0, 0);
+   }
+}
+
+void expr_parse_product (struct expr_parser *p)
+{
+   expr_parse_power (p);
+   for (;;)
+   {
+      char op;
+      expr_skip_space (p);
+      op = *p->s;
+      if (op != '*' && op != '/')
+         break;
+      p->s++;
+      expr_parse_power (p);
+      expr_emit (p, op == '*' ? expr_mul : expr_div, 0, 0);
+   }
+}
+
+void expr_parse_sum (struct expr_parser *p)
+{
+   expr_parse_product (p);
+   for (;;)
+   {
+      char op;
+      expr_skip_space (p);
+      op = *p->s;
+      if (op != '+' && op != '-')
+         break;
+      p->s++;
+      expr_parse_product (p);
+      expr_emit (p, op == '+' ? expr_add : expr_sub, 0, 0);
+   }
+}
+
+// Compile expression. Returns 0 on success.
+int expr_compile (struct expr_data *this,
+                  const struct context_rmcios *context, const char *text)
+{
+   struct expr_parser p = {.expr = this,.context = context,.s = text };
+   this->length = 0;
+   this->stack_size = 0;
+   this->num_inputs = 0;
+   expr_parse_sum (&p);
+   expr_skip_space (&p);
+   if (*p.s != 0)
+      p.error = 1;
+   if (p.error)
+      this->length = 0;
+   return p.error ? -1 : 0;
+}
+
+float expr_evaluate (struct expr_data *this,
+                     const struct context_rmcios *context,
+                     enum type_rmcios paramtype, int num_params,
+                     const union param_rmcios param)
+{
+   float inputs[EXPR_MAX_INPUTS];
+   float stack[this->stack_size + 1];
+   int sp = -1;
+   int i;
+
+   if (this->length == 0)
+      return NAN;
+   for (i = 0; i < this->num_inputs; i++)
+      inputs[i] = read_f (context, this->inputs[i]);
+
+   for (i = 0; i < this->length; i++)
+   {
+      const struct expr_instruction *in = this->program + i;
+      switch (in->op)
+      {
+      case expr_const:
+         stack[++sp] = in->value;
+         break;
+      case expr_input:
+         stack[++sp] = inputs[in->index];
+         break;
+      case expr_param:
+         stack[++sp] = in->index < num_params ?
+            param_to_float (context, paramtype, param, in->index) : NAN;
+         break;
+      case expr_add:
+         sp--;
+         stack[sp] += stack[sp + 1];
+         break;
+      case expr_sub:
+         sp--;
+         stack[sp] -= stack[sp + 1];
+         break;
+      case expr_mul:
+         sp--;
+         stack[sp] *= stack[sp + 1];
+         break;
+      case expr_div:
+         sp--;
+         stack[sp] /= stack[sp + 1];
+         break;
+      case expr_pow:
+      case expr_min:
+      case expr_max:
+         sp--;
+         stack[sp] = expr_apply (in->op, stack[sp], stack[sp + 1]);
+         break;
+      default:
+         stack[sp] = expr_apply (in->op, stack[sp], 0);
+         break;
+      }
+   }
+   return stack[0];
+}
+
+void expr_class_func (struct expr_data *this,
+                      const struct context_rmcios *context, int id,
+                      enum function_rmcios function,
+                      enum type_rmcios paramtype,
                       struct combo_rmcios *returnv,
                       int num_params, const union param_rmcios param)
 {
@@ -122,38 +773,850 @@ void sqrt_class_func (struct oper *this, struct context_rmcios *context,
    {
    case help_rmcios:
       return_string (context, returnv,
-                     "help for sqrt square root channel:\r\n"
-                     " create sqrt newname\r\n"
-                     " write newname X # calculate result=sqrt(X) \r\n"
-                     " read newname #read result\r\n"
+                     "help for expr arithmetic expression channel:\r\n"
+                     " create expr newname\r\n"
+                     " setup newname expression\r\n"
+                     "  -operators: + - * / ^ ( )\r\n"
+                     "  -functions: sqrt exp log log10 sin cos tan abs"
+                     " pow(a,b) min(a,b) max(a,b)\r\n"
+                     "  -names are channels that are read on evaluation\r\n"
+                     "  -$1 $2... are write/read parameters\r\n"
+                     "  -example: setup e (a*b+c)/sqrt($1)\r\n"
+                     " write newname | params... #calculate and send"
+                     " result to linked channels\r\n"
+                     " read newname | params... #calculate result\r\n"
+                     " link newname channel #link result to channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+
+      // allocate new data
+      this = (struct expr_data *)
+             allocate_storage (context, sizeof (struct expr_data), 0);
+      if (this == NULL)
+         break;
+
+      //default values :
+      this->program = NULL;
+      this->length = 0;
+      this->capacity = 0;
+      this->stack_size = 0;
+      this->num_inputs = 0;
+      this->result = NAN;
+
+      // create channel
+      create_channel_param (context, paramtype, param, 0,
+                            (class_rmcios) expr_class_func, this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         // Parameters are joined with spaces to single expression
+         int length = 0;
+         int i;
+         for (i = 0; i < num_params; i++)
+            length += param_string_alloc_size (context, paramtype, param, i);
+         {
+            char text[length + num_params];
+            int pos = 0;
+            for (i = 0; i < num_params; i++)
+            {
+               int slen = param_string_alloc_size (context, paramtype,
+                                                   param, i);
+               param_to_string (context, paramtype, param, i, slen,
+                                text + pos);
+               pos += strlen (text + pos);
+               text[pos++] = ' ';
+            }
+            text[pos] = 0;
+            if (expr_compile (this, context, text) != 0)
+               info (context, context->errors,
+                     "expr: Invalid expression!\r\n");
+         }
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      this->result = expr_evaluate (this, context, paramtype, num_params,
+                                    param);
+      write_f (context, linked_channels (context, id), this->result);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      this->result = expr_evaluate (this, context, paramtype, num_params,
+                                    param);
+      return_float (context, returnv, this->result);
+      break;
+
+   default:
+      break;
+   }
+}
+
+///////////////////////////////////////////////
+//! Sliding window statistics channel
+///////////////////////////////////////////////
+struct stats_sample
+{
+   float value;
+   double time;
+};
+
+// Double ended queue of sample slots in the ring
+struct stats_deque
+{
+   int *slot;
+   int head;
+   int length;
+};
+
+struct stats_data
+{
+   int id;
+   struct stats_sample *samples;
+   int capacity;
+   int first;             // Slot of the oldest sample
+   int count;             // Samples in the ring
+   double window_time;    // Seconds. 0 for count window only.
+
+   // Welford running mean and sum of squared differences
+   double mean;
+   double m2;
+
+   // Candidates for minimum and maximum from oldest to newest sample
+   struct stats_deque min;
+   struct stats_deque max;
+};
+
+int stats_deque_front (struct stats_deque *q, int capacity)
+{
+   return q->slot[q->head];
+}
+
+int stats_deque_back (struct stats_deque *q, int capacity)
+{
+   return q->slot[(q->head + q->length - 1) % capacity];
+}
+
+void stats_deque_push (struct stats_deque *q, int capacity, int slot)
+{
+   q->slot[(q->head + q->length) % capacity] = slot;
+   q->length++;
+}
+
+void stats_deque_pop_front (struct stats_deque *q, int capacity)
+{
+   q->head = (q->head + 1) % capacity;
+   q->length--;
+}
+
+int stats_count (struct stats_data *this)
+{
+   return this->count;
+}
+
+float stats_value (struct stats_data *this, int slot)
+{
+   return this->samples[slot].value;
+}
+
+// Remove the oldest sample
+void stats_evict (struct stats_data *this)
+{
+   int slot = this->first;
+   float x = stats_value (this, slot);
+   int n;
+   this->first = (this->first + 1) % this->capacity;
+   n = --this->count;
+   if (n == 0)
+   {
+      this->mean = 0;
+      this->m2 = 0;
+   }
+   else
+   {
+      double mean = (this->mean * (n + 1) - x) / n;
+      this->m2 -= (x - this->mean) * (x - mean);
+      if (this->m2 < 0)
+         this->m2 = 0;
+      this->mean = mean;
+   }
+   // Candidates are live samples, so their slots are unique
+   if (this->min.length > 0 
+       && stats_deque_front (&this->min, this->capacity) == slot)
+      stats_deque_pop_front (&this->min, this->capacity);
+   if (this->max.length > 0 
+       && stats_deque_front (&this->max, this->capacity) == slot)
+      stats_deque_pop_front (&this->max, this->capacity);
+}
+
+void stats_push (struct stats_data *this, float x, double time)
+{
+   int slot;
+   double delta;
+   int n;
+
+   if (this->capacity == 0 || isnan (x))
+      return;
+   if (stats_count (this) == this->capacity)
+      stats_evict (this);
+   while (this->window_time > 0 && stats_count (this) > 0
+          && this->samples[this->first].time
+          <= time - this->window_time)
+      stats_evict (this);
+
+   slot = (this->first + this->count) % this->capacity;
+   this->samples[slot].value = x;
+   this->samples[slot].time = time;
+
+   n = ++this->count;
+   delta = x - this->mean;
+   this->mean += delta / n;
+   this->m2 += delta * (x - this->mean);
+
+   // Drop candidates that can no longer be the extreme
+   while (this->min.length > 0
+          && stats_value (this, stats_deque_back (&this->min,
+                                                  this->capacity)) >= x)
+      this->min.length--;
+   stats_deque_push (&this->min, this->capacity, slot);
+   while (this->max.length > 0
+          && stats_value (this, stats_deque_back (&this->max,
+                                                  this->capacity)) <= x)
+      this->max.length--;
+   stats_deque_push (&this->max, this->capacity, slot);
+}
+
+void stats_reset (struct stats_data *this)
+{
+   this->first = 0;
+   this->count = 0;
+   this->mean = 0;
+   this->m2 = 0;
+   this->min.head = 0;
+   this->min.length = 0;
+   this->max.head = 0;
+   this->max.length = 0;
+}
+
+float stats_mean (struct stats_data *this)
+{
+   return stats_count (this) > 0 ? this->mean : NAN;
+}
+
+// Sample standard deviation
+float stats_std (struct stats_data *this)
+{
+   int n = stats_count (this);
+   return n > 1 ? sqrt (this->m2 / (n - 1)) : NAN;
+}
+
+float stats_min (struct stats_data *this)
+{
+   if (this->min.length == 0)
+      return NAN;
+   return stats_value (this, stats_deque_front (&this->min, this->capacity));
+}
+
+float stats_max (struct stats_data *this)
+{
+   if (this->max.length == 0)
+      return NAN;
+   return stats_value (this, stats_deque_front (&this->max, this->capacity));
+}
+
+void stats_mean_subchan_func (struct stats_data *this,
+                              const struct context_rmcios *context, int id,
+                              enum function_rmcios function,
+                              enum type_rmcios paramtype,
+                              struct combo_rmcios *returnv,
+                              int num_params, const union param_rmcios param)
+{
+   if (function == read_rmcios)
+      return_float (context, returnv, stats_mean (this));
+}
+
+void stats_std_subchan_func (struct stats_data *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   if (function == read_rmcios)
+      return_float (context, returnv, stats_std (this));
+}
+
+void stats_min_subchan_func (struct stats_data *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   if (function == read_rmcios)
+      return_float (context, returnv, stats_min (this));
+}
+
+void stats_max_subchan_func (struct stats_data *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   if (function == read_rmcios)
+      return_float (context, returnv, stats_max (this));
+}
+
+void stats_count_subchan_func (struct stats_data *this,
+                               const struct context_rmcios *context, int id,
+                               enum function_rmcios function,
+                               enum type_rmcios paramtype,
+                               struct combo_rmcios *returnv,
+                               int num_params,
+                               const union param_rmcios param)
+{
+   if (function == read_rmcios)
+      return_int (context, returnv, stats_count (this));
+}
+
+void stats_class_func (struct stats_data *this,
+                       const struct context_rmcios *context, int id,
+                       enum function_rmcios function,
+                       enum type_rmcios paramtype,
+                       struct combo_rmcios *returnv,
+                       int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "help for stats sliding window statistics channel:\r\n"
+                     " create stats newname\r\n"
+                     " setup newname samples | window_time\r\n"
+                     "  -samples: maximum number of samples in window\r\n"
+                     "  -window_time: maximum sample age in seconds."
+                     " 0 for none (default)\r\n"
+                     " write newname value | timestamp\r\n"
+                     "  -add sample. Mean is sent to linked channels.\r\n"
+                     "  -timestamp in seconds with sub-ms precision."
+                     " Default internal clock.\r\n"
+                     " write newname #clear window\r\n"
+                     " read newname #read mean std min max count\r\n"
+                     " read newname_mean\r\n"
+                     " read newname_std #sample standard deviation\r\n"
+                     " read newname_min\r\n"
+                     " read newname_max\r\n"
+                     " read newname_count\r\n"
+                     " link newname channel #link mean to channel\r\n");
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+
+      // allocate new data
+      this = (struct stats_data *)
+             allocate_storage (context, sizeof (struct stats_data), 0);
+      if (this == NULL)
+         break;
+
+      //default values :
+      this->samples = NULL;
+      this->min.slot = NULL;
+      this->max.slot = NULL;
+      this->capacity = 0;
+      this->window_time = 0;
+      stats_reset (this);
+
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) stats_class_func,
+                                       this);
+      create_subchannel_str (context, this->id, "_mean",
+                             (class_rmcios) stats_mean_subchan_func, this);
+      create_subchannel_str (context, this->id, "_std",
+                             (class_rmcios) stats_std_subchan_func, this);
+      create_subchannel_str (context, this->id, "_min",
+                             (class_rmcios) stats_min_subchan_func, this);
+      create_subchannel_str (context, this->id, "_max",
+                             (class_rmcios) stats_max_subchan_func, this);
+      create_subchannel_str (context, this->id, "_count",
+                             (class_rmcios) stats_count_subchan_func, this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         int capacity = param_to_int (context, paramtype, param, 0);
+         if (capacity < 1)
+            capacity = 1;
+         free (this->samples);
+         free (this->min.slot);
+         free (this->max.slot);
+         this->samples = malloc (capacity * sizeof (struct stats_sample));
+         this->min.slot = malloc (capacity * sizeof (int));
+         this->max.slot = malloc (capacity * sizeof (int));
+         this->capacity = capacity;
+         if (this->samples == NULL || this->min.slot == NULL
+             || this->max.slot == NULL)
+         {
+            info (context, context->errors,
+                  "stats: Could not allocate window!\r\n");
+            this->capacity = 0;
+         }
+         stats_reset (this);
+      }
+      if (num_params < 2)
+         break;
+      this->window_time = param_to_float (context, paramtype, param, 1);
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+      {
+         stats_reset (this);
+         break;
+      }
+      stats_push (this, param_to_float (context, paramtype, param, 0),
+                  num_params > 1 ?
+                  param_to_timestamp (context, paramtype, param, 1) :
+                  monotonic_time ());
+      write_f (context, linked_channels (context, id), stats_mean (this));
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_float (context, returnv, stats_mean (this));
+      return_float (context, returnv, stats_std (this));
+      return_float (context, returnv, stats_min (this));
+      return_float (context, returnv, stats_max (this));
+      return_int (context, returnv, stats_count (this));
+      break;
+
+   default:
+      break;
+   }
+}
+
+////////////////////////////////////////////////
+// Calibration channel
+////////////////////////////////////////////////
+enum calib_mode
+{
+   calib_poly,
+   calib_linear,
+   calib_cubic
+};
+
+struct calib_data
+{
+   int id;
+   enum calib_mode mode;
+   int n;            // Number of coefficients or table points
+   float *c;         // Polynomial coefficients, lowest order first
+   float *x;         // Table points, increasing x
+   float *y;
+   float *m;         // Tangents at table points
+
+   int uniform;      // Table x is evenly spaced
+   float inv_step;
+   int segment;      // Last used table segment
+
+   float *block;     // Array write values
+   int block_size;
+   float output;
+};
+
+float calib_poly_eval (const float *c, int n, float x)
+{
+   float y = 0;
+   int i;
+   for (i = n - 1; i >= 0; i--)
+      y = y * x + c[i];
+   return y;
+}
+
+// Table segment i with x[i] <= value < x[i+1], clamped to ends.
+int calib_segment (struct calib_data *this, float value)
+{
+   const float *x = this->x;
+   int last = this->n - 2;
+   int low, high;
+
+   if (this->uniform)
+   {
+      int i = (int) ((value - x[0]) * this->inv_step);
+      if (value < x[0] || i < 0)
+         return 0;
+      return i > last ? last : i;
+   }
+
+   // Consecutive samples usually hit the same or next segment
+   low = this->segment;
+   if (value >= x[low] && value < x[low + 1])
+      return low;
+   if (low < last && value >= x[low + 1] && value < x[low + 2])
+      return ++this->segment;
+
+   low = 0;
+   high = last;
+   while (low < high)
+   {
+      int middle = (low + high + 1) / 2;
+      if (x[middle] <= value)
+         low = middle;
+      else
+         high = middle - 1;
+   }
+   this->segment = low;
+   return low;
+}
+
+float calib_eval (struct calib_data *this, float value)
+{
+   const float *x = this->x;
+   const float *y = this->y;
+   const float *m = this->m;
+   float h, t;
+   int i;
+
+   if (this->n == 0)
+      return value;
+   if (this->mode == calib_poly)
+      return calib_poly_eval (this->c, this->n, value);
+
+   // Linear extrapolation with end tangents
+   if (value <= x[0])
+      return y[0] + m[0] * (value - x[0]);
+   if (value >= x[this->n - 1])
+      return y[this->n - 1] + m[this->n - 1] * (value - x[this->n - 1]);
+
+   i = calib_segment (this, value);
+   h = x[i + 1] - x[i];
+   t = (value - x[i]) / h;
+   if (this->mode == calib_linear)
+      return y[i] + t * (y[i + 1] - y[i]);
+
+   // Cubic Hermite segment
+   {
+      float t2 = t * t;
+      float t3 = t2 * t;
+      return (2 * t3 - 3 * t2 + 1) * y[i] + (t3 - 2 * t2 + t) * h * m[i]
+         + (-2 * t3 + 3 * t2) * y[i + 1] + (t3 - t2) * h * m[i + 1];
+   }
+}
+
+// Tangents for table interpolation. Fritsch-Carlson limited for cubic
+// interpolation to keep monotone data monotone.
+void calib_tangents (struct calib_data *this)
+{
+   const float *x = this->x;
+   const float *y = this->y;
+   float *m = this->m;
+   int n = this->n;
+   int i;
+
+   for (i = 0; i < n - 1; i++)
+      m[i] = (y[i + 1] - y[i]) / (x[i + 1] - x[i]);
+   m[n - 1] = m[n - 2];
+   if (this->mode != calib_cubic)
+      return;
+
+   // m[i] holds the secant of segment i until replaced below
+   {
+      float previous = m[0];
+      for (i = 1; i < n - 1; i++)
+      {
+         float secant = m[i];
+         m[i] = (previous * secant <= 0) ? 0 : (previous + secant) / 2;
+         previous = secant;
+      }
+   }
+   for (i = 0; i < n - 1; i++)
+   {
+      float secant = (y[i + 1] - y[i]) / (x[i + 1] - x[i]);
+      if (secant == 0)
+      {
+         m[i] = 0;
+         m[i + 1] = 0;
+      }
+      else
+      {
+         float a = m[i] / secant;
+         float b = m[i + 1] / secant;
+         float r = a * a + b * b;
+         if (r > 9)
+         {
+            float tau = 3 / sqrt (r);
+            m[i] = tau * a * secant;
+            m[i + 1] = tau * b * secant;
+         }
+      }
+   }
+}
+
+void calib_free (struct calib_data *this)
+{
+   free (this->c);
+   free (this->x);
+   free (this->y);
+   free (this->m);
+   this->c = NULL;
+   this->x = NULL;
+   this->y = NULL;
+   this->m = NULL;
+   this->n = 0;
+}
+
+void calib_class_func (struct calib_data *this,
+                       const struct context_rmcios *context, int id,
+                       enum function_rmcios function,
+                       enum type_rmcios paramtype,
+                       struct combo_rmcios *returnv,
+                       int num_params, const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "help for calibration channel:\r\n"
+                     " create calib newname\r\n"
+                     " setup newname poly c0 | c1 c2 ...\r\n"
+                     "  -polynomial y = c0 + c1*x + c2*x^2 ...\r\n"
+                     " setup newname linear x0 y0 x1 y1 | x2 y2 ...\r\n"
+                     "  -table with linear interpolation\r\n"
+                     " setup newname cubic x0 y0 x1 y1 | x2 y2 ...\r\n"
+                     "  -table with monotone cubic interpolation\r\n"
+                     "  -table x must be increasing. Values outside the\r\n"
+                     "   table are extrapolated linearly.\r\n"
+                     " write newname x1 | x2 ...\r\n"
+                     "  -calibrate values. Results are sent to linked\r\n"
+                     "   channels.\r\n"
+                     " read newname #read latest result\r\n"
                      " link newname channel #link result to channel\r\n");
       break;
 
    case create_rmcios:
       if (num_params < 1)
          break;
-      
+
       // allocate new data
-      this = (struct oper *) 
-             allocate_storage (context, sizeof (struct oper), 0);       
+      this = (struct calib_data *)
+             allocate_storage (context, sizeof (struct calib_data), 0);
+      if (this == NULL)
+         break;
 
       //default values :
-      this->valueA = 1;
-      this->valueB = 1;
-      this->valueA_channel = 0;
-      this->valueB_channel = 0;
-      
+      memset (this, 0, sizeof (struct calib_data));
+      this->mode = calib_poly;
+      this->output = NAN;
+
       // create channel
-      create_channel_param (context, paramtype, param, 0, 
-                            (class_rmcios) sqrt_class_func, this); 
+      this->id = create_channel_param (context, paramtype, param, 0,
+                                       (class_rmcios) calib_class_func,
+                                       this);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      {
+         // New curve replaces the current one only when it is valid
+         struct calib_data curve;
+         char type[8];
+         int i;
+         param_to_string (context, paramtype, param, 0, sizeof (type), type);
+         memset (&curve, 0, sizeof (curve));
+
+         if (strcmp (type, "poly") == 0)
+         {
+            curve.mode = calib_poly;
+            curve.c = malloc ((num_params - 1) * sizeof (float));
+            if (curve.c == NULL)
+            {
+               info (context, context->errors,
+                     "calib: Could not allocate curve!\r\n");
+               break;
+            }
+            curve.n = num_params - 1;
+            for (i = 0; i < curve.n; i++)
+               curve.c[i] = param_to_float (context, paramtype, param,
+                                            i + 1);
+         }
+         else
+         {
+            int n = (num_params - 1) / 2;
+            float step;
+            if (strcmp (type, "linear") == 0)
+               curve.mode = calib_linear;
+            else if (strcmp (type, "cubic") == 0)
+               curve.mode = calib_cubic;
+            else
+            {
+               info (context, context->errors,
+                     "calib: Unknown calibration type!\r\n");
+               break;
+            }
+            if (num_params < 5)
+            {
+               info (context, context->errors,
+                     "calib: Table needs at least 2 points!\r\n");
+               break;
+            }
+            if ((num_params - 1) % 2 != 0)
+            {
+               info (context, context->errors,
+                     "calib: Table needs x y pairs!\r\n");
+               break;
+            }
+
+            curve.x = malloc (n * sizeof (float));
+            curve.y = malloc (n * sizeof (float));
+            curve.m = malloc (n * sizeof (float));
+            if (curve.x == NULL || curve.y == NULL || curve.m == NULL)
+            {
+               info (context, context->errors,
+                     "calib: Could not allocate curve!\r\n");
+               calib_free (&curve);
+               break;
+            }
+            for (i = 0; i < n; i++)
+            {
+               curve.x[i] = param_to_float (context, paramtype, param,
+                                            2 * i + 1);
+               curve.y[i] = param_to_float (context, paramtype, param,
+                                            2 * i + 2);
+               if (i > 0 && !(curve.x[i] > curve.x[i - 1]))
+                  break;
+            }
+            if (i < n)
+            {
+               info (context, context->errors,
+                     "calib: Table x must be increasing!\r\n");
+               calib_free (&curve);
+               break;
+            }
+            curve.n = n;
+            calib_tangents (&curve);
+
+            // Evenly spaced table is indexed directly
+            step = (curve.x[n - 1] - curve.x[0]) / (n - 1);
+            curve.inv_step = 1 / step;
+            curve.uniform = 1;
+            for (i = 1; i < n; i++)
+            {
+               if (fabs (curve.x[i] - (curve.x[0] + i * step))
+                   > 1e-4 * step)
+                  curve.uniform = 0;
+            }
+         }
+
+         calib_free (this);
+         this->mode = curve.mode;
+         this->n = curve.n;
+         this->c = curve.c;
+         this->x = curve.x;
+         this->y = curve.y;
+         this->m = curve.m;
+         this->uniform = curve.uniform;
+         this->inv_step = curve.inv_step;
+         this->segment = 0;
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      if (num_params == 1)
+      {
+         this->output =
+            calib_eval (this, param_to_float (context, paramtype, param, 0));
+         write_f (context, linked_channels (context, id), this->output);
+         break;
+      }
+      {
+         int i;
+         if (num_params > this->block_size)
+         {
+            float *block = realloc (this->block,
+                                    num_params * sizeof (float));
+            if (block == NULL)
+               break;
+            this->block = block;
+            this->block_size = num_params;
+         }
+         for (i = 0; i < num_params; i++)
+            this->block[i] = param_to_float (context, paramtype, param, i);
+         if (this->mode == calib_poly && this->n > 0)
+         {
+            for (i = 0; i < num_params; i++)
+               this->block[i] = calib_poly_eval (this->c, this->n,
+                                                 this->block[i]);
+         }
+         else
+         {
+            for (i = 0; i < num_params; i++)
+               this->block[i] = calib_eval (this, this->block[i]);
+         }
+         this->output = this->block[num_params - 1];
+         write_fv (context, linked_channels (context, id), num_params,
+                   this->block);
+      }
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_float (context, returnv, this->output);
+      break;
+
+   default:
       break;
    }
-   // use generic implementation
-   generic_std_operator_class_func (this, context, id, function, paramtype, 
-                                returnv, num_params, param, sqrt_func); 
 }
 
 void init_std_math_channels (const struct context_rmcios *context)
 {
    create_channel_str (context, "sqrt", (class_rmcios) sqrt_class_func, NULL);
+   create_channel_str (context, "add", (class_rmcios) add_class_func, NULL);
+   create_channel_str (context, "sub", (class_rmcios) sub_class_func, NULL);
+   create_channel_str (context, "mul", (class_rmcios) mul_class_func, NULL);
+   create_channel_str (context, "div", (class_rmcios) div_class_func, NULL);
+   create_channel_str (context, "pow", (class_rmcios) pow_class_func, NULL);
+   create_channel_str (context, "min", (class_rmcios) min_class_func, NULL);
+   create_channel_str (context, "max", (class_rmcios) max_class_func, NULL);
+   create_channel_str (context, "log", (class_rmcios) log_class_func, NULL);
+   create_channel_str (context, "exp", (class_rmcios) exp_class_func, NULL);
+   create_channel_str (context, "abs", (class_rmcios) abs_class_func, NULL);
+   create_channel_str (context, "clamp", (class_rmcios) clamp_class_func,
+                       NULL);
+   create_channel_str (context, "scale", (class_rmcios) scale_class_func,
+                       NULL);
+   create_channel_str (context, "expr", (class_rmcios) expr_class_func, NULL);
+   create_channel_str (context, "stats", (class_rmcios) stats_class_func,
+                       NULL);
+   create_channel_str (context, "calib", (class_rmcios) calib_class_func,
+                       NULL);
 }
@@ -0,0 +1,68 @@
+/* Copyright (c) 2018 Frans Korhonen, Institute for Atmospheric and Earth System Research / Physics, Faculty of Science, University of Helsinki, Finland
+
+This file is part of RMCIOS.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Monotonic time source for channels that need to measure intervals
+ * without going through a clock channel.
+ * Include after RMCIOS-functions.h.
+ */
+#ifndef monotonic_time_h
+#define monotonic_time_h
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <stdlib.h>
+
+// Seconds from an arbitrary starting point. 
+// Not affected by changes to the system clock.
+static inline double monotonic_time (void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency ;
+	LARGE_INTEGER counter ;
+	QueryPerformanceFrequency (&frequency) ;
+	QueryPerformanceCounter (&counter) ;
+	return (double) counter.QuadPart / (double) frequency.QuadPart ;
+#else
+	struct timespec ts ;
+	clock_gettime (CLOCK_MONOTONIC, &ts) ;
+	return ts.tv_sec + ts.tv_nsec * 1e-9 ;
+#endif
+}
+
+// Timestamp parameter in seconds with double precision.
+// Text parameters are parsed directly, float parameters only have
+// 24 bits of precision (0.06 s at 1e6 s uptime).
+static inline double param_to_timestamp (const struct context_rmcios *context,
+                                         enum type_rmcios paramtype,
+                                         const union param_rmcios param,
+                                         int index)
+{
+	char text[64] ;
+	if (paramtype == float_rmcios) return param.fv[index] ;
+	if (paramtype == int_rmcios) return param.iv[index] ;
+	param_to_string (context, paramtype, param, index, sizeof (text), text) ;
+	return strtod (text, NULL) ;
+}
+
+#endif
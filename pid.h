@@ -20,6 +20,8 @@ along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
  * PID control function
  * 2017-11-17 FK, Added conditional for P-only loop to prevent division by zero
  * 2018-01-23 FK, Added safe-output variable to set output to safe value on calculation error (-Inf +Inf NaN etc)
+ * Added struct of arrays version for updating many loops in one pass
+ * Skip integral and derivative terms when dt is not positive (dt==0 divided by zero)
  */
 #ifndef pid_h
 #define pid_h
@@ -46,6 +48,7 @@ struct pid_type
 	// Channel interface added:
 	int linked_channel ;
 	int clock_channel ;
+	double last_time ; // Timestamp of previous update. NAN before first update.
 } ;
 
 float pid_control(struct pid_type *t,float measured_value,float dt)
@@ -56,9 +59,12 @@ float pid_control(struct pid_type *t,float measured_value,float dt)
 
 	// Calculate pid:
 	float error = t->setpoint - measured_value ;
-  	float derivative= (error - t->previous_error ) ;
-	t->integral = t->integral + error*dt ;
-	derivative = (error - t->previous_error)/dt ;
+  	float derivative= 0 ;
+	if(dt > 0) 
+	{
+		t->integral = t->integral + error*dt ;
+		derivative = (error - t->previous_error)/dt ;
+	}
   	t->output = t->Kp*error + t->Ki*t->integral + t->Kd*derivative ;
   	t->previous_error = error ;
 	
@@ -79,6 +85,64 @@ float pid_control(struct pid_type *t,float measured_value,float dt)
 	return t->output ;
 }
 
+// Struct of arrays for updating many pid loops in a single pass.
+struct pid_batch_type
+{
+	int size ;
+	float *setpoint ;
+	float *Kp ;
+	float *Ki ;
+	float *Kd ;
+
+	float *input_min ;
+	float *input_max ;
+
+	float *output_min ;
+	float *output_max ;
+
+	float *previous_error ;
+	float *integral ;
+	float *output ;
+
+	// Channel interface added:
+	int *linked_channel ;
+	int clock_channel ;
+	double last_time ;
+} ;
+
+// Same calculation as pid_control() for all loops. 
+// Written without branches in the loop body so that it can be vectorized.
+void pid_control_batch(struct pid_batch_type *t,const float *measured_value,float dt)
+{
+	int i ;
+	for(i=0 ; i < t->size ; i++)
+	{
+		float measured = measured_value[i] ;
+		float error, derivative, integral, output, limit ;
+		int saturated ;
+
+		// force measured value between max input range:
+		measured = measured > t->input_max[i] ? t->input_max[i] : measured ;
+		measured = measured < t->input_min[i] ? t->input_min[i] : measured ;
+
+		// Calculate pid:
+		error = t->setpoint[i] - measured ;
+		derivative = dt > 0 ? (error - t->previous_error[i])/dt : 0 ;
+		integral = dt > 0 ? t->integral[i] + error*dt : t->integral[i] ;
+		output = t->Kp[i]*error + t->Ki[i]*integral + t->Kd[i]*derivative ;
+
+		// Force integral to fit output inside output value limits:
+		saturated = (output > t->output_max[i] || output < t->output_min[i]) && t->Ki[i]!=0 ;
+		limit = output > t->output_max[i] ? t->output_max[i] : t->output_min[i] ;
+		integral = saturated ? (limit - t->Kp[i] * error)/t->Ki[i] : integral ;
+		output = saturated ? t->Kp[i]*error + t->Ki[i]*integral : output ;
+
+		t->integral[i] = integral ;
+		t->output[i] = output ;
+		t->previous_error[i] = saturated ? 0 : error ; // ignore the derivative
+	}
+}
+
 #endif 
 
 
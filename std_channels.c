@@ -45,6 +45,7 @@ void init_std_channels (const struct context_rmcios *context)
    init_std_parse_channels (context);
    init_std_util_channels (context);
    init_std_dma_channels (context);
+   init_std_filter_channels (context);
 }
 
 #ifdef INDEPENDENT_CHANNEL_MODULE
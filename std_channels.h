@@ -42,6 +42,7 @@ extern void init_std_math_channels(const struct context_rmcios *context) ;
 extern void init_std_parse_channels(const struct context_rmcios *context) ;
 extern void init_std_util_channels(const struct context_rmcios *context) ;
 extern void init_std_dma_channels(const struct context_rmcios *context) ;
+extern void init_std_filter_channels(const struct context_rmcios *context) ;
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,319 @@
+/* Copyright (c) 2018 Frans Korhonen, Institute for Atmospheric and Earth System Research / Physics, Faculty of Science, University of Helsinki, Finland
+
+This file is part of RMCIOS.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Element-wise float array kernels for the math and filter channels.
+ * out[i] = op(a[i], b, c) for constant b and c.
+ * y[i] += a * x[i] for FIR convolution.
+ * One biquad step over independent lanes for IIR filter banks.
+ * SSE and AVX versions are selected at runtime by cpu features.
+ */
+#ifndef vector_kernels_h
+#define vector_kernels_h
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+enum vector_op
+{
+	vector_op_none,   // No kernel. Operation is done per element by caller.
+	vector_op_add,    // a + b
+	vector_op_sub,    // a - b
+	vector_op_mul,    // a * b
+	vector_op_div,    // a / b
+	vector_op_min,    // min(a, b)
+	vector_op_max,    // max(a, b)
+	vector_op_scale,  // a * b + c
+	vector_op_clamp,  // fminf(fmaxf(a, b), c), as the simd min/max
+	vector_op_abs,    // |a|
+	vector_op_sqrt    // sqrt(a)
+} ;
+
+typedef void (*vector_kernel)(enum vector_op op, const float *a, float b,
+                              float c, float *out, int n) ;
+
+static inline void vector_kernel_scalar(enum vector_op op, const float *a,
+                                        float b, float c, float *out, int n)
+{
+	int i ;
+	switch(op)
+	{
+	case vector_op_add:
+		for(i=0 ; i<n ; i++) out[i] = a[i] + b ;
+		break ;
+	case vector_op_sub:
+		for(i=0 ; i<n ; i++) out[i] = a[i] - b ;
+		break ;
+	case vector_op_mul:
+		for(i=0 ; i<n ; i++) out[i] = a[i] * b ;
+		break ;
+	case vector_op_div:
+		for(i=0 ; i<n ; i++) out[i] = a[i] / b ;
+		break ;
+	case vector_op_min:
+		for(i=0 ; i<n ; i++) out[i] = a[i] < b ? a[i] : b ;
+		break ;
+	case vector_op_max:
+		for(i=0 ; i<n ; i++) out[i] = a[i] > b ? a[i] : b ;
+		break ;
+	case vector_op_scale:
+		for(i=0 ; i<n ; i++) out[i] = a[i] * b + c ;
+		break ;
+	case vector_op_clamp:
+		for(i=0 ; i<n ; i++) out[i] = fminf(fmaxf(a[i], b), c) ;
+		break ;
+	case vector_op_abs:
+		for(i=0 ; i<n ; i++) out[i] = fabsf(a[i]) ;
+		break ;
+	case vector_op_sqrt:
+		for(i=0 ; i<n ; i++) out[i] = sqrtf(a[i]) ;
+		break ;
+	default:
+		break ;
+	}
+}
+
+#ifdef VECTOR_KERNELS_X86
+__attribute__((target("sse")))
+static inline void vector_kernel_sse(enum vector_op op, const float *a,
+                                     float b, float c, float *out, int n)
+{
+	__m128 vb = _mm_set1_ps(b) ;
+	__m128 vc = _mm_set1_ps(c) ;
+	__m128 sign = _mm_set1_ps(-0.0f) ;
+	int i ;
+	for(i=0 ; i+4 <= n ; i+=4)
+	{
+		__m128 va = _mm_loadu_ps(a+i) ;
+		__m128 r ;
+		switch(op)
+		{
+		case vector_op_add: r = _mm_add_ps(va, vb) ; break ;
+		case vector_op_sub: r = _mm_sub_ps(va, vb) ; break ;
+		case vector_op_mul: r = _mm_mul_ps(va, vb) ; break ;
+		case vector_op_div: r = _mm_div_ps(va, vb) ; break ;
+		case vector_op_min: r = _mm_min_ps(va, vb) ; break ;
+		case vector_op_max: r = _mm_max_ps(va, vb) ; break ;
+		case vector_op_scale: r = _mm_add_ps(_mm_mul_ps(va, vb), vc) ; break ;
+		case vector_op_clamp: r = _mm_min_ps(_mm_max_ps(va, vb), vc) ; break ;
+		case vector_op_abs: r = _mm_andnot_ps(sign, va) ; break ;
+		case vector_op_sqrt: r = _mm_sqrt_ps(va) ; break ;
+		default: return ;
+		}
+		_mm_storeu_ps(out+i, r) ;
+	}
+	vector_kernel_scalar(op, a+i, b, c, out+i, n-i) ;
+}
+
+__attribute__((target("avx")))
+static inline void vector_kernel_avx(enum vector_op op, const float *a,
+                                     float b, float c, float *out, int n)
+{
+	__m256 vb = _mm256_set1_ps(b) ;
+	__m256 vc = _mm256_set1_ps(c) ;
+	__m256 sign = _mm256_set1_ps(-0.0f) ;
+	int i ;
+	for(i=0 ; i+8 <= n ; i+=8)
+	{
+		__m256 va = _mm256_loadu_ps(a+i) ;
+		__m256 r ;
+		switch(op)
+		{
+		case vector_op_add: r = _mm256_add_ps(va, vb) ; break ;
+		case vector_op_sub: r = _mm256_sub_ps(va, vb) ; break ;
+		case vector_op_mul: r = _mm256_mul_ps(va, vb) ; break ;
+		case vector_op_div: r = _mm256_div_ps(va, vb) ; break ;
+		case vector_op_min: r = _mm256_min_ps(va, vb) ; break ;
+		case vector_op_max: r = _mm256_max_ps(va, vb) ; break ;
+		case vector_op_scale: r = _mm256_add_ps(_mm256_mul_ps(va, vb), vc) ; break ;
+		case vector_op_clamp: r = _mm256_min_ps(_mm256_max_ps(va, vb), vc) ; break ;
+		case vector_op_abs: r = _mm256_andnot_ps(sign, va) ; break ;
+		case vector_op_sqrt: r = _mm256_sqrt_ps(va) ; break ;
+		default: return ;
+		}
+		_mm256_storeu_ps(out+i, r) ;
+	}
+	vector_kernel_scalar(op, a+i, b, c, out+i, n-i) ;
+}
+#endif
+
+// Best kernel for the running cpu
+static inline vector_kernel vector_kernel_select(void)
+{
+	static vector_kernel selected = NULL ;
+	if(selected != NULL) return selected ;
+	selected = vector_kernel_scalar ;
+#ifdef VECTOR_KERNELS_X86
+	__builtin_cpu_init() ;
+	if(__builtin_cpu_supports("avx")) selected = vector_kernel_avx ;
+	else if(__builtin_cpu_supports("sse")) selected = vector_kernel_sse ;
+#endif
+	return selected ;
+}
+
+// out[i] = op(a[i], b, c) for i < n
+static inline void vector_apply(enum vector_op op, const float *a, float b,
+                                float c, float *out, int n)
+{
+	vector_kernel_select()(op, a, b, c, out, n) ;
+}
+
+// Filter kernels
+typedef void (*vector_axpy_kernel)(float *y, float a, const float *x, int n) ;
+
+// Biquad coefficients are b0 b1 b2 a1 a2 (a0 normalized to 1).
+// Transposed direct form II step for each lane, x is replaced by output.
+typedef void (*vector_biquad_kernel)(const float *coef, float *x,
+                                     float *z1, float *z2, int n) ;
+
+static inline void vector_axpy_scalar(float *y, float a, const float *x, int n)
+{
+	int i ;
+	for(i=0 ; i<n ; i++) y[i] += a * x[i] ;
+}
+
+static inline void vector_biquad_scalar(const float *coef, float *x,
+                                        float *z1, float *z2, int n)
+{
+	int i ;
+	for(i=0 ; i<n ; i++)
+	{
+		float in = x[i] ;
+		float out = coef[0] * in + z1[i] ;
+		z1[i] = coef[1] * in - coef[3] * out + z2[i] ;
+		z2[i] = coef[2] * in - coef[4] * out ;
+		x[i] = out ;
+	}
+}
+
+#ifdef VECTOR_KERNELS_X86
+__attribute__((target("sse")))
+static inline void vector_axpy_sse(float *y, float a, const float *x, int n)
+{
+	__m128 va = _mm_set1_ps(a) ;
+	int i ;
+	for(i=0 ; i+4 <= n ; i+=4)
+	{
+		__m128 r = _mm_add_ps(_mm_loadu_ps(y+i),
+		                      _mm_mul_ps(va, _mm_loadu_ps(x+i))) ;
+		_mm_storeu_ps(y+i, r) ;
+	}
+	vector_axpy_scalar(y+i, a, x+i, n-i) ;
+}
+
+__attribute__((target("avx")))
+static inline void vector_axpy_avx(float *y, float a, const float *x, int n)
+{
+	__m256 va = _mm256_set1_ps(a) ;
+	int i ;
+	for(i=0 ; i+8 <= n ; i+=8)
+	{
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(y+i),
+		                         _mm256_mul_ps(va, _mm256_loadu_ps(x+i))) ;
+		_mm256_storeu_ps(y+i, r) ;
+	}
+	vector_axpy_scalar(y+i, a, x+i, n-i) ;
+}
+
+__attribute__((target("sse")))
+static inline void vector_biquad_sse(const float *coef, float *x,
+                                     float *z1, float *z2, int n)
+{
+	__m128 b0 = _mm_set1_ps(coef[0]) ;
+	__m128 b1 = _mm_set1_ps(coef[1]) ;
+	__m128 b2 = _mm_set1_ps(coef[2]) ;
+	__m128 a1 = _mm_set1_ps(coef[3]) ;
+	__m128 a2 = _mm_set1_ps(coef[4]) ;
+	int i ;
+	for(i=0 ; i+4 <= n ; i+=4)
+	{
+		__m128 in = _mm_loadu_ps(x+i) ;
+		__m128 out = _mm_add_ps(_mm_mul_ps(b0, in), _mm_loadu_ps(z1+i)) ;
+		__m128 s1 = _mm_sub_ps(_mm_mul_ps(b1, in), _mm_mul_ps(a1, out)) ;
+		__m128 s2 = _mm_sub_ps(_mm_mul_ps(b2, in), _mm_mul_ps(a2, out)) ;
+		_mm_storeu_ps(z1+i, _mm_add_ps(s1, _mm_loadu_ps(z2+i))) ;
+		_mm_storeu_ps(z2+i, s2) ;
+		_mm_storeu_ps(x+i, out) ;
+	}
+	vector_biquad_scalar(coef, x+i, z1+i, z2+i, n-i) ;
+}
+
+__attribute__((target("avx")))
+static inline void vector_biquad_avx(const float *coef, float *x,
+                                     float *z1, float *z2, int n)
+{
+	__m256 b0 = _mm256_set1_ps(coef[0]) ;
+	__m256 b1 = _mm256_set1_ps(coef[1]) ;
+	__m256 b2 = _mm256_set1_ps(coef[2]) ;
+	__m256 a1 = _mm256_set1_ps(coef[3]) ;
+	__m256 a2 = _mm256_set1_ps(coef[4]) ;
+	int i ;
+	for(i=0 ; i+8 <= n ; i+=8)
+	{
+		__m256 in = _mm256_loadu_ps(x+i) ;
+		__m256 out = _mm256_add_ps(_mm256_mul_ps(b0, in),
+		                           _mm256_loadu_ps(z1+i)) ;
+		__m256 s1 = _mm256_sub_ps(_mm256_mul_ps(b1, in),
+		                          _mm256_mul_ps(a1, out)) ;
+		__m256 s2 = _mm256_sub_ps(_mm256_mul_ps(b2, in),
+		                          _mm256_mul_ps(a2, out)) ;
+		_mm256_storeu_ps(z1+i, _mm256_add_ps(s1, _mm256_loadu_ps(z2+i))) ;
+		_mm256_storeu_ps(z2+i, s2) ;
+		_mm256_storeu_ps(x+i, out) ;
+	}
+	vector_biquad_scalar(coef, x+i, z1+i, z2+i, n-i) ;
+}
+#endif
+
+// y[i] += a * x[i] for i < n
+static inline void vector_axpy(float *y, float a, const float *x, int n)
+{
+	static vector_axpy_kernel selected = NULL ;
+	if(selected == NULL)
+	{
+		selected = vector_axpy_scalar ;
+#ifdef VECTOR_KERNELS_X86
+		__builtin_cpu_init() ;
+		if(__builtin_cpu_supports("avx")) selected = vector_axpy_avx ;
+		else if(__builtin_cpu_supports("sse")) selected = vector_axpy_sse ;
+#endif
+	}
+	selected(y, a, x, n) ;
+}
+
+// One biquad step for n independent lanes sharing coefficients
+static inline void vector_biquad(const float *coef, float *x,
+                                 float *z1, float *z2, int n)
+{
+	static vector_biquad_kernel selected = NULL ;
+	if(selected == NULL)
+	{
+		selected = vector_biquad_scalar ;
+#ifdef VECTOR_KERNELS_X86
+		__builtin_cpu_init() ;
+		if(__builtin_cpu_supports("avx")) selected = vector_biquad_avx ;
+		else if(__builtin_cpu_supports("sse")) selected = vector_biquad_sse ;
+#endif
+	}
+	selected(coef, x, z1, z2, n) ;
+}
+
+#endif